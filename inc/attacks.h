@@ -1,10 +1,30 @@
 #ifndef ATTACKS_H
 #define ATTACKS_H
 
+#include <stdint.h>
 #include "image.h"
 
-// Attack functions
+#define ATTACK_SEED 54321  // Default seed for reproducible noise attacks
+
+// Attack functions (return a new attacked copy)
 MyImage* attack_noise(MyImage* img, int noise_level);
+MyImage* attack_gaussian(MyImage* img, double sigma);
+MyImage* attack_crop(MyImage* img, int x, int y, int width, int height);
+MyImage* attack_scale(MyImage* img, double factor);
+MyImage* attack_blur(MyImage* img);
+MyImage* attack_sharpen(MyImage* img, double amount);
 MyImage* attack_quality(MyImage* img, int quality);
+MyImage* attack_quality_profile(MyImage* img, int quality, CodecProfile profile);
+
+// In-memory attacks writing into a caller-provided image (return 1 on success).
+// Noise attacks may run in place (dst == src); blur and sharpen need dst != src.
+// Noise is drawn from a counter-based RNG keyed by (seed, row, column), so the
+// result is reproducible and independent of thread count.
+int attack_noise_into(MyImage* src, MyImage* dst, int noise_level, uint64_t seed);
+int attack_gaussian_into(MyImage* src, MyImage* dst, double sigma, uint64_t seed);
+int attack_crop_into(MyImage* src, MyImage* dst, int x, int y);
+int attack_scale_into(MyImage* src, MyImage* dst);
+int attack_blur_into(MyImage* src, MyImage* dst);
+int attack_sharpen_into(MyImage* src, MyImage* dst, double amount);
 
 #endif /* ATTACKS_H */
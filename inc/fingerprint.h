@@ -0,0 +1,84 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FINGERPRINT_MAGIC 0x50464D57  // "WMFP"
+#define FINGERPRINT_VERSION 1
+#define FINGERPRINT_MAX_K 64  // Most matches a single search returns
+
+#define FINGERPRINT_MIH_MAGIC 0x484D4D57  // "WMMH"
+#define FINGERPRINT_MIH_VERSION 1
+#define FINGERPRINT_MIH_MAX_TABLES 64
+#define FINGERPRINT_MIH_MAX_SUBSTRING 24  // Bits per substring (bucket directory <= 64 MB)
+
+// On-disk layout: a fixed header followed by fixed-size records, each a
+// 64-bit recipient ID and the payload packed MSB-first into 64-bit words
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t payload_bits;
+    uint32_t payload_words;
+    uint64_t count;
+    uint64_t generation;  // Random ID given at create, so hash tables can tell indexes apart
+    uint64_t reserved[4];
+} FingerprintHeader;
+
+// Multi-index hashing sidecar ("<index>.mih"). The payload is cut into
+// num_tables substrings, and each table buckets the record numbers by one
+// substring. A record within r bit errors of the query is within r / num_tables
+// errors on at least one substring, so a search only probes buckets near the
+// query's substrings. Each table is (2^substring_bits + 1) uint32 bucket
+// starts followed by count uint32 record numbers.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t payload_bits;
+    uint32_t num_tables;
+    uint64_t count;       // Records covered; records appended later are scanned
+    uint64_t generation;  // Generation of the index the tables were built from
+    uint32_t substring_offset[FINGERPRINT_MIH_MAX_TABLES];
+    uint32_t substring_bits[FINGERPRINT_MIH_MAX_TABLES];
+    uint64_t table_offset[FINGERPRINT_MIH_MAX_TABLES];
+} FingerprintMihHeader;
+
+// Read-only, memory-mapped view of an index file and its hash tables
+typedef struct {
+    void *map;
+    size_t map_size;
+    int payload_bits;
+    int payload_words;
+    uint64_t count;
+    uint64_t generation;
+    const uint64_t *records;  // count * (1 + payload_words) words
+    void *mih_map;            // NULL when there are no usable hash tables
+    size_t mih_map_size;
+    const FingerprintMihHeader *mih;
+} FingerprintIndex;
+
+typedef struct {
+    uint64_t recipient_id;
+    uint64_t record;  // Position of the payload in the index
+    int distance;     // Bit errors between the query and the issued payload
+} FingerprintMatch;
+
+// Index building (payloads are packed bytes, as produced by extract_watermark)
+int fingerprint_index_create(const char *filename, int payload_bits);
+int fingerprint_index_append(const char *filename, const uint64_t *recipient_ids,
+                             const char *payloads, int num_payloads);
+// (Re)build the hash tables for all records currently in the index. Payloads
+// too long for FINGERPRINT_MIH_MAX_TABLES substrings of at most
+// FINGERPRINT_MIH_MAX_SUBSTRING bits get no tables and are scanned.
+int fingerprint_index_build_mih(const char *filename);
+
+// Lookup: fills up to k matches within max_distance bits, nearest first,
+// and returns how many were found. With hash tables, the cost grows with the
+// distance of the k-th match; when probing would cost more than a scan, the
+// covered records are scanned instead. The result is exact either way.
+FingerprintIndex* fingerprint_index_open(const char *filename);
+void fingerprint_index_close(FingerprintIndex *index);
+int fingerprint_index_search(const FingerprintIndex *index, const char *payload, int max_distance,
+                             FingerprintMatch *matches, int k);
+
+#endif
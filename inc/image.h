@@ -9,6 +9,23 @@ typedef struct {
     int height;
 } MyImage;
 
+// Codec profiles: named libjpeg settings that each pipeline stage can pick
+typedef enum {
+    CODEC_PROFILE_DEFAULT = 0,  // Plain libjpeg defaults
+    CODEC_PROFILE_SIMULATE,     // Fast integer DCT (throwaway outputs)
+    CODEC_PROFILE_DELIVER,      // Accurate DCT, optimized Huffman tables, progressive
+    CODEC_PROFILE_STREAM,       // Accurate DCT, baseline, restart marker every MCU row
+    NUM_CODEC_PROFILES
+} CodecProfile;
+
+typedef struct {
+    const char *name;
+    int fast_dct;           // JDCT_IFAST instead of JDCT_ISLOW
+    int optimize_coding;    // Per-image optimized Huffman tables on encode
+    int progressive;        // Progressive instead of baseline output
+    int restart_rows;       // Restart marker every N MCU rows on encode (0 = none)
+} CodecSettings;
+
 // Image manipulation functions
 MyImage* create_image(int width, int height);
 void free_image(MyImage *img);
@@ -16,8 +33,17 @@ MyImage* copy_image(MyImage *src);
 void add_noise(MyImage *img, int noise_level);
 void create_test_image(MyImage *img);
 
+// Codec profile lookup
+const CodecSettings* get_codec_settings(CodecProfile profile);
+
 // JPEG operations
 int save_jpeg(MyImage *img, const char *filename, int quality);
 MyImage* load_jpeg(const char *filename);
+int save_jpeg_profile(MyImage *img, const char *filename, int quality, CodecProfile profile);
+MyImage* load_jpeg_profile(const char *filename, CodecProfile profile);
+
+// Luminance quantization tables (64 entries, natural order)
+int read_jpeg_quant_table(const char *filename, unsigned short qtable[64]);
+void quality_quant_table(int quality, unsigned short qtable[64]);
 
 #endif
@@ -7,6 +7,8 @@
 #include "dct.h"
 #include "watermark.h"
 #include "attacks.h"
+#include "parallel_jpeg.h"
+#include "fingerprint.h"
 
 // Holds DCT coefficient arrays
 typedef struct {
@@ -0,0 +1,16 @@
+#ifndef PARALLEL_JPEG_H
+#define PARALLEL_JPEG_H
+
+#include "image.h"
+
+// Encode horizontal bands on separate threads and stitch them into one
+// baseline JPEG with a restart marker every MCU row (num_bands <= 0 uses
+// one band per thread).
+int save_jpeg_parallel(MyImage *img, const char *filename, int quality, int num_bands);
+
+// Split the entropy-coded data at restart markers and decode the segments on
+// separate threads (num_threads <= 0 uses all threads). Falls back to
+// load_jpeg for progressive files or files without row-aligned restarts.
+MyImage* load_jpeg_parallel(const char *filename, int num_threads);
+
+#endif
@@ -2,6 +2,50 @@
 #define WATERMARK_H
 
 #include "image.h"
+#include "dct.h"
+
+#define WATERMARK_SEED 12345  // Seed for the block sequence
+#define WATERMARK_INDEX_MAGIC 0x34494D57  // "WMI4"
+
+#define PLAN_CACHE_SIZE 8  // Embedding plans kept in the LRU cache
+
+// Precompiled embedding plan for one (width, height, seed, payload length):
+// the block order, pixel offsets of each block and the DCT basis functions of
+// the coefficient pair, so embedding and extraction skip all per-image setup
+typedef struct {
+    int width;
+    int height;
+    int seed;
+    int watermark_length;
+    int num_bits;       // Bits that fit in the image
+    int *block;         // Block number carrying each bit
+    int *row;           // Top pixel row of each bit's block
+    int *col;           // Left pixel column of each bit's block
+    double basis_34[BLOCK_SIZE][BLOCK_SIZE];
+    double basis_43[BLOCK_SIZE][BLOCK_SIZE];
+} EmbedPlan;
+
+// Sidecar record of one embedded bit
+typedef struct {
+    int block;          // Block number (row-major) carrying the bit
+    int bit;            // Bit embedded in the master
+    int next;           // Next record on the same block, -1 if last (not saved)
+    unsigned char pixels[BLOCK_SIZE * BLOCK_SIZE];  // Original block (first record on a block only)
+} WatermarkIndexEntry;
+
+// Sidecar block index of a watermarked master image. It holds the original
+// pixels of every marked block, so it must stay with the master and never
+// ship with copies.
+typedef struct {
+    int width;
+    int height;
+    int seed;
+    int watermark_length;
+    double alpha;
+    int auto_strength;             // 1 if embedded with auto strength (pairs kept 2*alpha apart)
+    int num_entries;
+    WatermarkIndexEntry *entries;  // One per embedded bit, in embedding order
+} WatermarkIndex;
 
 // Watermarking functions
 void embed_watermark(MyImage *img, char *watermark, int watermark_length, double alpha);
@@ -9,4 +53,36 @@ void extract_watermark(MyImage *img, char *extracted_watermark, int watermark_le
 double calculate_similarity(char *watermark1, char *watermark2, int length);
 void generate_sequence(int *sequence, int length, int seed);
 
+// Embedding plans. Plans are owned by the cache and stay valid until evicted
+// by PLAN_CACHE_SIZE newer plans or clear_embed_plans (not thread-safe). A
+// plan only applies to an image of the size it was built for; the plan
+// functions print an error and leave the image untouched otherwise (the
+// extracted watermark reads as all zeros).
+EmbedPlan* get_embed_plan(int width, int height, int seed, int watermark_length);
+void clear_embed_plans(void);
+void embed_watermark_plan(MyImage *img, const EmbedPlan *plan, char *watermark, double alpha);
+void extract_watermark_plan(MyImage *img, const EmbedPlan *plan, char *extracted_watermark);
+
+// Auto strength: derive alpha from a JPEG luminance quantization table
+// (natural order) so the (3,4)/(4,3) order survives re-compression with it,
+// and spread every pair closer than that in a single pass
+double alpha_from_quant_table(const unsigned short qtable[BLOCK_SIZE * BLOCK_SIZE]);
+void embed_watermark_auto(MyImage *img, char *watermark, int watermark_length,
+                          const unsigned short qtable[BLOCK_SIZE * BLOCK_SIZE]);
+WatermarkIndex* embed_watermark_indexed_auto(MyImage *img, char *watermark, int watermark_length,
+                                             const unsigned short qtable[BLOCK_SIZE * BLOCK_SIZE]);
+
+// Incremental re-marking: embed once with an index, then re-mark only the
+// blocks whose bits differ from the master's (returns blocks touched, -1 if the
+// index does not match the image). Re-mark a copy of the marked master: the
+// result is identical to a fresh embed of the new payload. The index is never
+// modified, so one index serves any number of variants, and rollback restores
+// the original pixels of every marked block on the master or any variant.
+WatermarkIndex* embed_watermark_indexed(MyImage *img, char *watermark, int watermark_length, double alpha);
+int remark_watermark(MyImage *img, WatermarkIndex *index, char *new_watermark);
+int rollback_watermark(MyImage *img, WatermarkIndex *index);
+int save_watermark_index(WatermarkIndex *index, const char *filename);
+WatermarkIndex* load_watermark_index(const char *filename);
+void free_watermark_index(WatermarkIndex *index);
+
 #endif
@@ -1,34 +1,318 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 #include "attacks.h"
+#include "dct.h"
 
-MyImage* attack_noise(MyImage* img, int noise_level) {
-    MyImage* noisy = copy_image(img);
-    
-    srand(54321); // Fixed seed for reproducibility
-    for (int i = 0; i < noisy->height; i++) {
-        for (int j = 0; j < noisy->width; j++) {
-            int noise = (rand() % (2 * noise_level + 1)) - noise_level;
-            int new_val = (int)noisy->data[i][j] + noise;
-            if (new_val < 0) new_val = 0;
-            if (new_val > 255) new_val = 255;
-            noisy->data[i][j] = (unsigned char)new_val;
+// Counter-based RNG: hashes (seed, counter) with the splitmix64 finalizer.
+// No shared state, so every pixel can draw its own value from any thread.
+static inline uint64_t rng_hash(uint64_t seed, uint64_t counter) {
+    uint64_t z = seed + (counter + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Per-pixel draw: a 32-bit hash of (row key, column). Each row gets its key
+// from rng_hash; the pixel hash only needs 32-bit multiplies, so pixel loops
+// vectorize (SSE2 has no 64-bit vector multiply).
+static inline uint32_t rng_hash32(uint32_t key, uint32_t counter) {
+    uint32_t z = key + (counter + 1) * 0x9E3779B9U;
+    z = (z ^ (z >> 16)) * 0x7FEB352DU;
+    z = (z ^ (z >> 15)) * 0x846CA68BU;
+    return z ^ (z >> 16);
+}
+
+static inline unsigned char clamp_pixel(int value) {
+    if (value < 0) value = 0;
+    if (value > 255) value = 255;
+    return (unsigned char)value;
+}
+
+static int same_size(MyImage* src, MyImage* dst) {
+    if (src->width != dst->width || src->height != dst->height) {
+        printf("Error: Attack destination is %dx%d, expected %dx%d\n",
+               dst->width, dst->height, src->width, src->height);
+        return 0;
+    }
+    return 1;
+}
+
+int attack_noise_into(MyImage* src, MyImage* dst, int noise_level, uint64_t seed) {
+    if (!same_size(src, dst)) return 0;
+    if (noise_level < 0 || noise_level > 32767) {
+        printf("Error: Noise level %d is outside [0, 32767]\n", noise_level);
+        return 0;
+    }
+    uint32_t range = 2 * (uint32_t)noise_level + 1;
+    int w = src->width;
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < src->height; i++) {
+        // Not restrict: noise attacks may run in place (in == out)
+        const unsigned char* in = src->data[i];
+        unsigned char* out = dst->data[i];
+        uint32_t key = (uint32_t)rng_hash(seed, i);
+        for (int j = 0; j < w; j++) {
+            // Map the top 16 bits onto [-noise_level, noise_level] without a division
+            uint32_t r = rng_hash32(key, j) >> 16;
+            int noise = (int)((r * range) >> 16) - noise_level;
+            out[j] = clamp_pixel((int)in[j] + noise);
         }
     }
-    
+    return 1;
+}
+
+int attack_gaussian_into(MyImage* src, MyImage* dst, double sigma, uint64_t seed) {
+    if (!same_size(src, dst)) return 0;
+    int w = src->width;
+
+    // Three passes per row so the hashing and the final add/clamp vectorize;
+    // only the Box-Muller pass with log/sqrt/cos stays scalar
+    #pragma omp parallel
+    {
+        uint32_t* restrict radius_draws = (uint32_t*)malloc(w * sizeof(uint32_t));
+        uint32_t* restrict angle_draws = (uint32_t*)malloc(w * sizeof(uint32_t));
+        double* restrict noise = (double*)malloc(w * sizeof(double));
+        #pragma omp for schedule(static)
+        for (int i = 0; i < src->height; i++) {
+            // Not restrict: noise attacks may run in place (in == out)
+            const unsigned char* in = src->data[i];
+            unsigned char* out = dst->data[i];
+            uint32_t radius_key = (uint32_t)rng_hash(seed, 2 * (uint64_t)i);
+            uint32_t angle_key = (uint32_t)rng_hash(seed, 2 * (uint64_t)i + 1);
+            for (int j = 0; j < w; j++) {
+                radius_draws[j] = rng_hash32(radius_key, j);
+                angle_draws[j] = rng_hash32(angle_key, j);
+            }
+            for (int j = 0; j < w; j++) {
+                // Box-Muller
+                double u1 = ((double)radius_draws[j] + 1.0) / 4294967296.0;
+                double u2 = (double)angle_draws[j] / 4294967296.0;
+                noise[j] = sigma * sqrt(-2.0 * log(u1)) * cos(2.0 * PI * u2);
+            }
+            for (int j = 0; j < w; j++) {
+                // Truncation rounds like lround wherever the result survives the clamp
+                out[j] = clamp_pixel((int)(in[j] + noise[j] + 0.5));
+            }
+        }
+        free(radius_draws);
+        free(angle_draws);
+        free(noise);
+    }
+    return 1;
+}
+
+int attack_crop_into(MyImage* src, MyImage* dst, int x, int y) {
+    if (x < 0 || y < 0 || x + dst->width > src->width || y + dst->height > src->height) {
+        printf("Error: Crop %dx%d at (%d,%d) is outside the %dx%d image\n",
+               dst->width, dst->height, x, y, src->width, src->height);
+        return 0;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < dst->height; i++) {
+        memcpy(dst->data[i], src->data[y + i] + x, dst->width);
+    }
+    return 1;
+}
+
+// Bilinear resampling from src to the size of dst, in 20.12 fixed point so the
+// products fit in 32 bits. Each row is a scalar horizontal pass that gathers the
+// source columns, then a vertical blend that vectorizes.
+int attack_scale_into(MyImage* src, MyImage* dst) {
+    int out_width = dst->width;
+    int *x0 = (int*)malloc(out_width * sizeof(int));
+    uint32_t *fx = (uint32_t*)malloc(out_width * sizeof(uint32_t));
+    double scale_x = (double)src->width / dst->width;
+    double scale_y = (double)src->height / dst->height;
+
+    for (int j = 0; j < out_width; j++) {
+        double sx = (j + 0.5) * scale_x - 0.5;
+        if (sx < 0) sx = 0;
+        if (sx > src->width - 1) sx = src->width - 1;
+        x0[j] = (int)sx;
+        if (x0[j] > src->width - 2) x0[j] = src->width > 1 ? src->width - 2 : 0;
+        fx[j] = (uint32_t)((sx - x0[j]) * 4096.0);
+    }
+
+    int has_next_col = src->width > 1;
+    #pragma omp parallel
+    {
+        uint32_t* restrict top_row = (uint32_t*)malloc(out_width * sizeof(uint32_t));
+        uint32_t* restrict bottom_row = (uint32_t*)malloc(out_width * sizeof(uint32_t));
+        #pragma omp for schedule(static)
+        for (int i = 0; i < dst->height; i++) {
+            double sy = (i + 0.5) * scale_y - 0.5;
+            if (sy < 0) sy = 0;
+            if (sy > src->height - 1) sy = src->height - 1;
+            int y0 = (int)sy;
+            int y1 = (y0 + 1 < src->height) ? y0 + 1 : y0;
+            uint32_t fy = (uint32_t)((sy - y0) * 4096.0);
+
+            const unsigned char* restrict top = src->data[y0];
+            const unsigned char* restrict bottom = src->data[y1];
+            unsigned char* restrict out = dst->data[i];
+            for (int j = 0; j < out_width; j++) {
+                int a = x0[j];
+                int b = a + has_next_col;
+                top_row[j] = top[a] * (4096 - fx[j]) + top[b] * fx[j];
+                bottom_row[j] = bottom[a] * (4096 - fx[j]) + bottom[b] * fx[j];
+            }
+            for (int j = 0; j < out_width; j++) {
+                uint32_t v = top_row[j] * (4096 - fy) + bottom_row[j] * fy;
+                out[j] = (unsigned char)((v + (1U << 23)) >> 24);
+            }
+        }
+        free(top_row);
+        free(bottom_row);
+    }
+
+    free(x0);
+    free(fx);
+    return 1;
+}
+
+// 3x3 binomial blur ([1 2 1] x [1 2 1] / 16) of row i, edges clamped.
+// Writes the blurred row to out and uses vsum as scratch (width entries).
+static void blur_row(MyImage* src, int i, unsigned char* out, int* vsum) {
+    int w = src->width;
+    const unsigned char* a = src->data[i > 0 ? i - 1 : 0];
+    const unsigned char* b = src->data[i];
+    const unsigned char* c = src->data[i + 1 < src->height ? i + 1 : i];
+
+    for (int j = 0; j < w; j++) {
+        vsum[j] = a[j] + 2 * b[j] + c[j];
+    }
+    if (w == 1) {
+        out[0] = (unsigned char)((4 * vsum[0] + 8) >> 4);
+        return;
+    }
+    out[0] = (unsigned char)((3 * vsum[0] + vsum[1] + 8) >> 4);
+    for (int j = 1; j < w - 1; j++) {
+        out[j] = (unsigned char)((vsum[j - 1] + 2 * vsum[j] + vsum[j + 1] + 8) >> 4);
+    }
+    out[w - 1] = (unsigned char)((vsum[w - 2] + 3 * vsum[w - 1] + 8) >> 4);
+}
+
+int attack_blur_into(MyImage* src, MyImage* dst) {
+    if (!same_size(src, dst)) return 0;
+    if (src == dst) {
+        printf("Error: Blur cannot run in place\n");
+        return 0;
+    }
+
+    #pragma omp parallel
+    {
+        int* vsum = (int*)malloc(src->width * sizeof(int));
+        #pragma omp for schedule(static)
+        for (int i = 0; i < src->height; i++) {
+            blur_row(src, i, dst->data[i], vsum);
+        }
+        free(vsum);
+    }
+    return 1;
+}
+
+// Unsharp mask: out = src + amount * (src - blur(src))
+int attack_sharpen_into(MyImage* src, MyImage* dst, double amount) {
+    if (!same_size(src, dst)) return 0;
+    if (src == dst) {
+        printf("Error: Sharpen cannot run in place\n");
+        return 0;
+    }
+    int gain = (int)lround(amount * 256.0);  // 8.8 fixed point
+    int w = src->width;
+
+    #pragma omp parallel
+    {
+        int* vsum = (int*)malloc(w * sizeof(int));
+        unsigned char* restrict blurred = (unsigned char*)malloc(w);
+        #pragma omp for schedule(static)
+        for (int i = 0; i < src->height; i++) {
+            const unsigned char* restrict in = src->data[i];
+            unsigned char* restrict out = dst->data[i];
+            blur_row(src, i, blurred, vsum);
+            for (int j = 0; j < w; j++) {
+                int detail = (int)in[j] - (int)blurred[j];
+                out[j] = clamp_pixel((int)in[j] + ((gain * detail + 128) >> 8));
+            }
+        }
+        free(vsum);
+        free(blurred);
+    }
+    return 1;
+}
+
+MyImage* attack_noise(MyImage* img, int noise_level) {
+    MyImage* noisy = copy_image(img);
+    attack_noise_into(noisy, noisy, noise_level, ATTACK_SEED);
+    return noisy;
+}
+
+MyImage* attack_gaussian(MyImage* img, double sigma) {
+    MyImage* noisy = copy_image(img);
+    attack_gaussian_into(noisy, noisy, sigma, ATTACK_SEED);
     return noisy;
 }
 
+MyImage* attack_crop(MyImage* img, int x, int y, int width, int height) {
+    // Clamp the crop window to the image
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (x + width > img->width) width = img->width - x;
+    if (y + height > img->height) height = img->height - y;
+    if (width <= 0 || height <= 0) {
+        printf("Error: Crop window is empty\n");
+        return NULL;
+    }
+
+    MyImage* cropped = create_image(width, height);
+    attack_crop_into(img, cropped, x, y);
+    return cropped;
+}
+
+MyImage* attack_scale(MyImage* img, double factor) {
+    int width = (int)lround(img->width * factor);
+    int height = (int)lround(img->height * factor);
+    if (width <= 0 || height <= 0) {
+        printf("Error: Scale factor %.3f gives an empty image\n", factor);
+        return NULL;
+    }
+
+    MyImage* scaled = create_image(width, height);
+    attack_scale_into(img, scaled);
+    return scaled;
+}
+
+MyImage* attack_blur(MyImage* img) {
+    MyImage* blurred = create_image(img->width, img->height);
+    attack_blur_into(img, blurred);
+    return blurred;
+}
+
+MyImage* attack_sharpen(MyImage* img, double amount) {
+    MyImage* sharpened = create_image(img->width, img->height);
+    attack_sharpen_into(img, sharpened, amount);
+    return sharpened;
+}
+
+// The re-compressed file is thrown away, so the fast simulate profile is used
 MyImage* attack_quality(MyImage* img, int quality) {
+    return attack_quality_profile(img, quality, CODEC_PROFILE_SIMULATE);
+}
+
+MyImage* attack_quality_profile(MyImage* img, int quality, CodecProfile profile) {
     char temp_filename[] = "temp_low_quality.jpg";
     
     // Save with lower quality
-    if (!save_jpeg(img, temp_filename, quality)) {
+    if (!save_jpeg_profile(img, temp_filename, quality, profile)) {
         return NULL;
     }
     
     // Reload the compressed image
-    MyImage* compressed = load_jpeg(temp_filename);
+    MyImage* compressed = load_jpeg_profile(temp_filename, profile);
     
     // Clean up temporary file
     remove(temp_filename);
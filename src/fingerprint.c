@@ -0,0 +1,586 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fingerprint.h"
+
+// A bucket probe costs about as much as scanning 20 records. Hash table
+// searches give up after count / MIH_SCAN_COST probes, so a search that falls
+// back to a scan spends up to about a third of a scan on probes first.
+#define MIH_SCAN_COST 64
+#define SCAN_CHUNK 65536  // Records per scan shard; smaller scans stay on one thread
+
+// x86 builds carry a second copy of the search compiled for the POPCNT
+// instruction; without it __builtin_popcountll becomes a libgcc call
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define FINGERPRINT_POPCNT_DISPATCH 1
+#endif
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// Pack payload bytes MSB-first into 64-bit words, clearing bits past payload_bits
+static void pack_payload(const char *payload, int payload_bits, int payload_words, uint64_t *words) {
+    int payload_bytes = (payload_bits + 7) / 8;
+    memset(words, 0, payload_words * sizeof(uint64_t));
+    for (int i = 0; i < payload_bytes; i++) {
+        unsigned char byte = (unsigned char)payload[i];
+        if (i == payload_bytes - 1 && payload_bits % 8) {
+            byte &= (unsigned char)(0xFF << (8 - payload_bits % 8));
+        }
+        words[i / 8] |= (uint64_t)byte << (56 - 8 * (i % 8));
+    }
+}
+
+// Bits [offset, offset + bits) of a packed payload (bits <= 32)
+static inline uint32_t substring_key(const uint64_t *words, int offset, int bits) {
+    int w = offset / 64;
+    int shift = offset % 64;
+    uint64_t value = words[w] << shift;
+    if (shift + bits > 64) value |= words[w + 1] >> (64 - shift);
+    return (uint32_t)(value >> (64 - bits));
+}
+
+static char* mih_filename(const char *filename) {
+    char *name = (char*)malloc(strlen(filename) + 5);
+    sprintf(name, "%s.mih", filename);
+    return name;
+}
+
+// Keep matches sorted by distance; *count grows up to k. A record already
+// held (a search can reach it through several tables) is not added twice.
+static void insert_match(FingerprintMatch *matches, int *count, int k, uint64_t recipient_id,
+                         uint64_t record, int distance) {
+    int pos;
+    for (int m = 0; m < *count; m++) {
+        if (matches[m].record == record) return;
+    }
+    if (*count < k) {
+        pos = (*count)++;
+    } else if (matches[k - 1].distance > distance) {
+        pos = k - 1;
+    } else {
+        return;
+    }
+    while (pos > 0 && matches[pos - 1].distance > distance) {
+        matches[pos] = matches[pos - 1];
+        pos--;
+    }
+    matches[pos].recipient_id = recipient_id;
+    matches[pos].record = record;
+    matches[pos].distance = distance;
+}
+
+// Largest distance that can still get into the matches
+static inline int match_limit(const FingerprintMatch *matches, int found, int k, int max_distance) {
+    if (found == k && matches[k - 1].distance - 1 < max_distance) {
+        return matches[k - 1].distance - 1;
+    }
+    return max_distance;
+}
+
+// The payload length sizes every record, so it must agree with the word count
+static int header_valid(const FingerprintHeader *header) {
+    return header->magic == FINGERPRINT_MAGIC && header->version == FINGERPRINT_VERSION &&
+           header->payload_bits > 0 && header->payload_bits <= INT32_MAX - 63 &&
+           header->payload_words == (header->payload_bits + 63) / 64;
+}
+
+// Whether a file of file_size bytes holds every record the header counts
+static int records_fit(const FingerprintHeader *header, uint64_t file_size) {
+    uint64_t record_bytes = (1 + (uint64_t)header->payload_words) * sizeof(uint64_t);
+    return file_size >= sizeof(FingerprintHeader) &&
+           header->count <= (file_size - sizeof(FingerprintHeader)) / record_bytes;
+}
+
+static int read_header(FILE *file, FingerprintHeader *header) {
+    return fread(header, sizeof(FingerprintHeader), 1, file) == 1 && header_valid(header);
+}
+
+int fingerprint_index_create(const char *filename, int payload_bits) {
+    FILE *outfile;
+    FingerprintHeader header;
+
+    if (payload_bits <= 0) {
+        printf("Error: Payload length must be positive\n");
+        return 0;
+    }
+    if ((outfile = fopen(filename, "wb")) == NULL) {
+        printf("Error: Cannot create fingerprint index %s\n", filename);
+        return 0;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = FINGERPRINT_MAGIC;
+    header.version = FINGERPRINT_VERSION;
+    header.payload_bits = payload_bits;
+    header.payload_words = (payload_bits + 63) / 64;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    header.generation = ((uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec) ^ ((uint64_t)getpid() << 32);
+    int ok = fwrite(&header, sizeof(header), 1, outfile) == 1;
+    if (fclose(outfile) != 0) ok = 0;
+    if (!ok) {
+        printf("Error: Cannot write fingerprint index %s\n", filename);
+    }
+
+    // Hash tables of an index previously at this path no longer apply
+    char *name = mih_filename(filename);
+    remove(name);
+    free(name);
+    return ok;
+}
+
+int fingerprint_index_append(const char *filename, const uint64_t *recipient_ids,
+                             const char *payloads, int num_payloads) {
+    FILE *file;
+    FingerprintHeader header;
+
+    if ((file = fopen(filename, "r+b")) == NULL) {
+        printf("Error: Cannot open fingerprint index %s\n", filename);
+        return 0;
+    }
+    if (!read_header(file, &header)) {
+        printf("Error: %s is not a fingerprint index\n", filename);
+        fclose(file);
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0 || !records_fit(&header, st.st_size)) {
+        printf("Error: Fingerprint index %s is truncated\n", filename);
+        fclose(file);
+        return 0;
+    }
+
+    int payload_bytes = (header.payload_bits + 7) / 8;
+    int record_words = 1 + header.payload_words;
+    uint64_t *record = (uint64_t*)malloc(record_words * sizeof(uint64_t));
+
+    // Records go after the ones the header accounts for, so a torn append is
+    // ignored; the count is only updated once every record is written
+    off_t end = (off_t)(sizeof(header) + header.count * record_words * sizeof(uint64_t));
+    int ok = fseeko(file, end, SEEK_SET) == 0;
+    for (int n = 0; ok && n < num_payloads; n++) {
+        record[0] = recipient_ids[n];
+        pack_payload(payloads + (size_t)n * payload_bytes, header.payload_bits,
+                     header.payload_words, record + 1);
+        ok = fwrite(record, sizeof(uint64_t), record_words, file) == (size_t)record_words;
+    }
+    ok = ok && fflush(file) == 0;
+
+    if (ok) {
+        header.count += num_payloads;
+        ok = fseeko(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    }
+    if (fclose(file) != 0) ok = 0;
+    free(record);
+    if (!ok) {
+        printf("Error: Cannot write to fingerprint index %s\n", filename);
+    }
+    return ok;
+}
+
+// Substring layout for count records: about log2(count) bits per substring,
+// so a bucket holds about one record, widened so long payloads still fit in
+// FINGERPRINT_MIH_MAX_TABLES tables. Fails when even the widest substrings
+// would need more tables.
+static int plan_substrings(FingerprintMihHeader *mih, int payload_bits, uint64_t count) {
+    int target = 8;
+    while (target < FINGERPRINT_MIH_MAX_SUBSTRING && ((uint64_t)1 << target) < count) target++;
+    int min_bits = (payload_bits + FINGERPRINT_MIH_MAX_TABLES - 1) / FINGERPRINT_MIH_MAX_TABLES;
+    if (min_bits > FINGERPRINT_MIH_MAX_SUBSTRING) return 0;
+    if (target < min_bits) target = min_bits;
+    if (target > payload_bits) target = payload_bits;
+
+    int num_tables = (payload_bits + target - 1) / target;
+
+    int offset = 0;
+    mih->num_tables = num_tables;
+    for (int t = 0; t < num_tables; t++) {
+        int bits = payload_bits / num_tables + (t < payload_bits % num_tables);
+        mih->substring_offset[t] = offset;
+        mih->substring_bits[t] = bits;
+        offset += bits;
+    }
+    return 1;
+}
+
+int fingerprint_index_build_mih(const char *filename) {
+    FingerprintIndex *index = fingerprint_index_open(filename);
+    if (!index) return 0;
+
+    FingerprintMihHeader mih;
+    memset(&mih, 0, sizeof(mih));
+    mih.magic = FINGERPRINT_MIH_MAGIC;
+    mih.version = FINGERPRINT_MIH_VERSION;
+    mih.payload_bits = index->payload_bits;
+    mih.count = index->count;
+    mih.generation = index->generation;
+    if (index->count > UINT32_MAX) {
+        printf("Error: Cannot build hash tables for %s (too many records)\n", filename);
+        fingerprint_index_close(index);
+        return 0;
+    }
+    if (!plan_substrings(&mih, index->payload_bits, index->count)) {
+        // Searches fall back to scanning, which is still exact
+        printf("Payloads of %d bits are too long for hash tables; %s will be scanned\n",
+               index->payload_bits, filename);
+        fingerprint_index_close(index);
+        return 1;
+    }
+
+    // Write to a temporary file and rename, so searches never see a partial table
+    char *name = mih_filename(filename);
+    char *temp_name = (char*)malloc(strlen(name) + 5);
+    sprintf(temp_name, "%s.tmp", name);
+    FILE *outfile;
+    if ((outfile = fopen(temp_name, "wb")) == NULL) {
+        printf("Error: Cannot create %s\n", temp_name);
+        free(name);
+        free(temp_name);
+        fingerprint_index_close(index);
+        return 0;
+    }
+
+    int record_words = 1 + index->payload_words;
+    uint32_t *records = (uint32_t*)malloc((index->count + 1) * sizeof(uint32_t));
+    int ok = fwrite(&mih, sizeof(mih), 1, outfile) == 1;
+    uint64_t offset = sizeof(mih);
+
+    // Counting sort of the record numbers by each substring
+    for (int t = 0; ok && t < (int)mih.num_tables; t++) {
+        int bits = mih.substring_bits[t];
+        size_t buckets = (size_t)1 << bits;
+        uint32_t *start = (uint32_t*)calloc(buckets + 1, sizeof(uint32_t));
+
+        for (uint64_t r = 0; r < index->count; r++) {
+            const uint64_t *payload = index->records + r * record_words + 1;
+            start[substring_key(payload, mih.substring_offset[t], bits) + 1]++;
+        }
+        for (size_t b = 0; b < buckets; b++) {
+            start[b + 1] += start[b];
+        }
+        for (uint64_t r = 0; r < index->count; r++) {
+            const uint64_t *payload = index->records + r * record_words + 1;
+            records[start[substring_key(payload, mih.substring_offset[t], bits)]++] = (uint32_t)r;
+        }
+        // The fill advanced every start to the next bucket's; shift them back
+        memmove(start + 1, start, buckets * sizeof(uint32_t));
+        start[0] = 0;
+
+        mih.table_offset[t] = offset;
+        ok = fwrite(start, sizeof(uint32_t), buckets + 1, outfile) == buckets + 1 &&
+             fwrite(records, sizeof(uint32_t), index->count, outfile) == index->count;
+        offset += (buckets + 1 + index->count) * sizeof(uint32_t);
+        free(start);
+    }
+
+    ok = ok && fseeko(outfile, 0, SEEK_SET) == 0 && fwrite(&mih, sizeof(mih), 1, outfile) == 1;
+    if (fclose(outfile) != 0) ok = 0;
+    ok = ok && rename(temp_name, name) == 0;
+    if (ok) {
+        printf("Built %d hash tables over %llu payloads in %s\n", mih.num_tables,
+               (unsigned long long)mih.count, name);
+    } else {
+        printf("Error: Cannot write %s\n", temp_name);
+        remove(temp_name);
+    }
+
+    free(records);
+    free(name);
+    free(temp_name);
+    fingerprint_index_close(index);
+    return ok;
+}
+
+// Maps "<filename>.mih" if it matches the index; searches scan without it
+static void open_mih(FingerprintIndex *index, const char *filename) {
+    char *name = mih_filename(filename);
+    int fd = open(name, O_RDONLY);
+    free(name);
+    if (fd < 0) return;
+
+    struct stat st;
+    FingerprintMihHeader header;
+    int ok = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(header) &&
+             pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+             header.magic == FINGERPRINT_MIH_MAGIC && header.version == FINGERPRINT_MIH_VERSION &&
+             header.payload_bits == (uint32_t)index->payload_bits && header.generation == index->generation &&
+             header.count <= index->count &&
+             header.num_tables > 0 && header.num_tables <= FINGERPRINT_MIH_MAX_TABLES;
+    for (uint32_t t = 0; ok && t < header.num_tables; t++) {
+        ok = header.substring_bits[t] > 0 && header.substring_bits[t] <= FINGERPRINT_MIH_MAX_SUBSTRING &&
+             (uint64_t)header.substring_offset[t] + header.substring_bits[t] <= header.payload_bits &&
+             header.table_offset[t] % sizeof(uint32_t) == 0 && header.table_offset[t] <= (uint64_t)st.st_size;
+        uint64_t table_size = (((uint64_t)1 << header.substring_bits[t]) + 1 + header.count) * sizeof(uint32_t);
+        ok = ok && table_size <= (uint64_t)st.st_size - header.table_offset[t];
+    }
+    if (!ok) {
+        printf("Warning: Ignoring stale or invalid hash tables for the fingerprint index\n");
+        close(fd);
+        return;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+
+    // Probes index the record lists through the bucket starts, so both must
+    // stay within the table
+    for (uint32_t t = 0; ok && t < header.num_tables; t++) {
+        const uint32_t *start = (const uint32_t*)((const char*)map + header.table_offset[t]);
+        size_t buckets = (size_t)1 << header.substring_bits[t];
+        const uint32_t *records = start + buckets + 1;
+        int bad = start[0] != 0 || start[buckets] != header.count;
+        for (size_t b = 0; b < buckets; b++) {
+            bad |= start[b] > start[b + 1];
+        }
+        for (uint64_t r = 0; r < header.count; r++) {
+            bad |= records[r] >= header.count;
+        }
+        ok = !bad;
+    }
+    if (!ok) {
+        printf("Warning: Ignoring stale or invalid hash tables for the fingerprint index\n");
+        munmap(map, st.st_size);
+        return;
+    }
+    index->mih_map = map;
+    index->mih_map_size = st.st_size;
+    index->mih = (const FingerprintMihHeader*)map;
+}
+
+FingerprintIndex* fingerprint_index_open(const char *filename) {
+    FingerprintHeader header;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        printf("Error: Cannot open fingerprint index %s\n", filename);
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header) ||
+        pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || !header_valid(&header)) {
+        printf("Error: %s is not a fingerprint index\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    if (!records_fit(&header, st.st_size)) {
+        printf("Error: Fingerprint index %s is truncated\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Error: Cannot map fingerprint index %s\n", filename);
+        return NULL;
+    }
+
+    FingerprintIndex *index = (FingerprintIndex*)malloc(sizeof(FingerprintIndex));
+    index->map = map;
+    index->map_size = st.st_size;
+    index->payload_bits = header.payload_bits;
+    index->payload_words = header.payload_words;
+    index->count = header.count;
+    index->generation = header.generation;
+    index->records = (const uint64_t*)((const char*)map + sizeof(header));
+    index->mih_map = NULL;
+    index->mih_map_size = 0;
+    index->mih = NULL;
+    open_mih(index, filename);
+    return index;
+}
+
+void fingerprint_index_close(FingerprintIndex *index) {
+    munmap(index->map, index->map_size);
+    if (index->mih_map) munmap(index->mih_map, index->mih_map_size);
+    free(index);
+}
+
+// Bit errors between a record's payload and the query, stopping once past limit
+static ALWAYS_INLINE int record_distance(const uint64_t *payload, const uint64_t *query, int words, int limit) {
+    int distance = 0;
+    for (int w = 0; w < words && distance <= limit; w++) {
+        distance += __builtin_popcountll(payload[w] ^ query[w]);
+    }
+    return distance;
+}
+
+// Scans records [start, end) into a top-k, tightening *limit as it fills
+static ALWAYS_INLINE void scan_shard(const FingerprintIndex *index, const uint64_t *query,
+                                     uint64_t start, uint64_t end, int *limit,
+                                     FingerprintMatch *matches, int *found, int k) {
+    int words = index->payload_words;
+    int record_words = 1 + words;
+    for (uint64_t r = start; r < end; r++) {
+        const uint64_t *record = index->records + r * record_words;
+        int distance = record_distance(record + 1, query, words, *limit);
+        if (distance > *limit) continue;
+
+        insert_match(matches, found, k, record[0], r, distance);
+        // Once k matches are held, only closer ones can get in
+        *limit = match_limit(matches, *found, k, *limit);
+    }
+}
+
+// Verify every record in one bucket of table t
+static ALWAYS_INLINE void probe_bucket(const FingerprintIndex *index, const uint64_t *query, int t,
+                                       uint32_t key, int max_distance, FingerprintMatch *matches,
+                                       int *found, int k) {
+    const FingerprintMihHeader *mih = index->mih;
+    const uint32_t *start = (const uint32_t*)((const char*)index->mih_map + mih->table_offset[t]);
+    const uint32_t *records = start + ((size_t)1 << mih->substring_bits[t]) + 1;
+    int words = index->payload_words;
+    int record_words = 1 + words;
+
+    for (uint32_t i = start[key]; i < start[key + 1]; i++) {
+        const uint64_t *record = index->records + (uint64_t)records[i] * record_words;
+        int limit = match_limit(matches, *found, k, max_distance);
+        int distance = record_distance(record + 1, query, words, limit);
+        if (distance <= limit) {
+            insert_match(matches, found, k, record[0], records[i], distance);
+        }
+    }
+}
+
+// Multi-index hashing over the records the tables cover: probe every bucket at
+// substring distance 0, 1, 2, ... until no unseen record can beat the k-th
+// match. Returns 0, with the search unfinished, once the probes would cost
+// more than scanning the covered records.
+static ALWAYS_INLINE int search_mih(const FingerprintIndex *index, const uint64_t *query, int max_distance,
+                                    FingerprintMatch *matches, int *found, int k) {
+    const FingerprintMihHeader *mih = index->mih;
+    int num_tables = mih->num_tables;
+    int max_bits = 0;
+    uint32_t query_key[FINGERPRINT_MIH_MAX_TABLES];
+    for (int t = 0; t < num_tables; t++) {
+        query_key[t] = substring_key(query, mih->substring_offset[t], mih->substring_bits[t]);
+        if ((int)mih->substring_bits[t] > max_bits) max_bits = mih->substring_bits[t];
+    }
+
+    double budget = (double)mih->count / MIH_SCAN_COST + 1024.0;
+    double probes = 0.0;
+    double combinations = 1.0;  // Keys at the current radius, C(max_bits, radius)
+
+    for (int radius = 0; radius <= max_bits; radius++) {
+        // Every unseen record differs by at least radius bits in each substring
+        if ((int64_t)num_tables * radius > match_limit(matches, *found, k, max_distance)) return 1;
+        if (radius > 0) combinations = combinations * (max_bits - radius + 1) / radius;
+        probes += num_tables * combinations;
+        if (probes > budget) return 0;
+
+        for (int t = 0; t < num_tables; t++) {
+            int bits = mih->substring_bits[t];
+            if (radius > bits) continue;
+            // Visit every set of radius bit positions in increasing order
+            int flip[FINGERPRINT_MIH_MAX_SUBSTRING];
+            for (int i = 0; i < radius; i++) flip[i] = i;
+            for (;;) {
+                uint32_t key = query_key[t];
+                for (int i = 0; i < radius; i++) key ^= 1U << flip[i];
+                probe_bucket(index, query, t, key, max_distance, matches, found, k);
+
+                int i = radius - 1;
+                while (i >= 0 && flip[i] == bits - radius + i) i--;
+                if (i < 0) break;
+                flip[i]++;
+                for (int j = i + 1; j < radius; j++) flip[j] = flip[j - 1] + 1;
+            }
+        }
+    }
+    return 1;
+}
+
+// Each kernel is compiled twice on x86: plain, and for the POPCNT instruction
+typedef void (*ScanShardFn)(const FingerprintIndex*, const uint64_t*, uint64_t, uint64_t, int*,
+                            FingerprintMatch*, int*, int);
+typedef int (*SearchMihFn)(const FingerprintIndex*, const uint64_t*, int, FingerprintMatch*, int*, int);
+
+static void scan_shard_generic(const FingerprintIndex *index, const uint64_t *query, uint64_t start,
+                               uint64_t end, int *limit, FingerprintMatch *matches, int *found, int k) {
+    scan_shard(index, query, start, end, limit, matches, found, k);
+}
+
+static int search_mih_generic(const FingerprintIndex *index, const uint64_t *query, int max_distance,
+                              FingerprintMatch *matches, int *found, int k) {
+    return search_mih(index, query, max_distance, matches, found, k);
+}
+
+#ifdef FINGERPRINT_POPCNT_DISPATCH
+__attribute__((target("popcnt")))
+static void scan_shard_popcnt(const FingerprintIndex *index, const uint64_t *query, uint64_t start,
+                              uint64_t end, int *limit, FingerprintMatch *matches, int *found, int k) {
+    scan_shard(index, query, start, end, limit, matches, found, k);
+}
+
+__attribute__((target("popcnt")))
+static int search_mih_popcnt(const FingerprintIndex *index, const uint64_t *query, int max_distance,
+                             FingerprintMatch *matches, int *found, int k) {
+    return search_mih(index, query, max_distance, matches, found, k);
+}
+#endif
+
+// Brute-force scan of records [start, end) in chunks: each thread keeps its
+// own top-k over its chunks, then merges
+static void scan_records(const FingerprintIndex *index, const uint64_t *query, ScanShardFn scan,
+                         uint64_t start, uint64_t end, int max_distance,
+                         FingerprintMatch *matches, int *found, int k) {
+    int shared_limit = match_limit(matches, *found, k, max_distance);
+    int64_t num_chunks = (int64_t)((end - start + SCAN_CHUNK - 1) / SCAN_CHUNK);
+
+    #pragma omp parallel if (num_chunks > 1)
+    {
+        FingerprintMatch local[FINGERPRINT_MAX_K];
+        int local_found = 0;
+        int limit = shared_limit;
+
+        #pragma omp for schedule(static)
+        for (int64_t c = 0; c < num_chunks; c++) {
+            uint64_t chunk_start = start + (uint64_t)c * SCAN_CHUNK;
+            uint64_t chunk_end = chunk_start + SCAN_CHUNK < end ? chunk_start + SCAN_CHUNK : end;
+            scan(index, query, chunk_start, chunk_end, &limit, local, &local_found, k);
+        }
+
+        #pragma omp critical
+        for (int m = 0; m < local_found; m++) {
+            insert_match(matches, found, k, local[m].recipient_id, local[m].record, local[m].distance);
+        }
+    }
+}
+
+int fingerprint_index_search(const FingerprintIndex *index, const char *payload, int max_distance,
+                             FingerprintMatch *matches, int k) {
+    if (k > FINGERPRINT_MAX_K) k = FINGERPRINT_MAX_K;
+    if (k <= 0) return 0;
+
+    int words = index->payload_words;
+    uint64_t *query = (uint64_t*)malloc(words * sizeof(uint64_t));
+    pack_payload(payload, index->payload_bits, words, query);
+
+    ScanShardFn scan = scan_shard_generic;
+    SearchMihFn probe = search_mih_generic;
+#ifdef FINGERPRINT_POPCNT_DISPATCH
+    if (__builtin_cpu_supports("popcnt")) {
+        scan = scan_shard_popcnt;
+        probe = search_mih_popcnt;
+    }
+#endif
+
+    int found = 0;
+    uint64_t covered = index->mih ? index->mih->count : 0;
+    // Records appended after the tables were built are always scanned
+    if (covered < index->count) {
+        scan_records(index, query, scan, covered, index->count, max_distance, matches, &found, k);
+    }
+    if (covered > 0 && !probe(index, query, max_distance, matches, &found, k)) {
+        scan_records(index, query, scan, 0, covered, max_distance, matches, &found, k);
+    }
+
+    free(query);
+    return found;
+}
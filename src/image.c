@@ -3,6 +3,7 @@
 #include <string.h>
 #include <jpeglib.h>
 #include "image.h"
+#include "attacks.h"
 
 MyImage* create_image(int width, int height) {
     MyImage *img = (MyImage*)malloc(sizeof(MyImage));
@@ -34,16 +35,7 @@ MyImage* copy_image(MyImage *src) {
 }
 
 void add_noise(MyImage *img, int noise_level) {
-    srand(54321);
-    for (int i = 0; i < img->height; i++) {
-        for (int j = 0; j < img->width; j++) {
-            int noise = (rand() % (2 * noise_level + 1)) - noise_level;
-            int new_val = (int)img->data[i][j] + noise;
-            if (new_val < 0) new_val = 0;
-            if (new_val > 255) new_val = 255;
-            img->data[i][j] = (unsigned char)new_val;
-        }
-    }
+    attack_noise_into(img, img, noise_level, ATTACK_SEED);
 }
 
 void create_test_image(MyImage *img) {
@@ -54,8 +46,33 @@ void create_test_image(MyImage *img) {
     }
 }
 
+// Codec profiles, indexed by CodecProfile
+static const CodecSettings codec_profiles[NUM_CODEC_PROFILES] = {
+    //  name        fast_dct  optimize_coding  progressive  restart_rows
+    { "default",   0,        0,               0,           0 },
+    { "simulate",  1,        0,               0,           0 },
+    { "deliver",   0,        1,               1,           0 },
+    { "stream",    0,        0,               0,           1 }
+};
+
+const CodecSettings* get_codec_settings(CodecProfile profile) {
+    if (profile < 0 || profile >= NUM_CODEC_PROFILES) {
+        profile = CODEC_PROFILE_DEFAULT;
+    }
+    return &codec_profiles[profile];
+}
+
 // JPEG functions implementation
 int save_jpeg(MyImage *img, const char *filename, int quality) {
+    return save_jpeg_profile(img, filename, quality, CODEC_PROFILE_DEFAULT);
+}
+
+MyImage* load_jpeg(const char *filename) {
+    return load_jpeg_profile(filename, CODEC_PROFILE_DEFAULT);
+}
+
+int save_jpeg_profile(MyImage *img, const char *filename, int quality, CodecProfile profile) {
+    const CodecSettings *settings = get_codec_settings(profile);
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr jerr;
     FILE *outfile;
@@ -78,6 +95,12 @@ int save_jpeg(MyImage *img, const char *filename, int quality) {
     
     jpeg_set_defaults(&cinfo);
     jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.dct_method = settings->fast_dct ? JDCT_IFAST : JDCT_ISLOW;
+    cinfo.optimize_coding = settings->optimize_coding ? TRUE : FALSE;
+    cinfo.restart_in_rows = settings->restart_rows;
+    if (settings->progressive) {
+        jpeg_simple_progression(&cinfo);
+    }
     jpeg_start_compress(&cinfo, TRUE);
     
     while (cinfo.next_scanline < cinfo.image_height) {
@@ -89,11 +112,12 @@ int save_jpeg(MyImage *img, const char *filename, int quality) {
     fclose(outfile);
     jpeg_destroy_compress(&cinfo);
     
-    printf("Saved JPEG image as %s (quality: %d)\n", filename, quality);
+    printf("Saved JPEG image as %s (quality: %d, profile: %s)\n", filename, quality, settings->name);
     return 1;
 }
 
-MyImage* load_jpeg(const char *filename) {
+MyImage* load_jpeg_profile(const char *filename, CodecProfile profile) {
+    const CodecSettings *settings = get_codec_settings(profile);
     struct jpeg_decompress_struct cinfo;
     struct jpeg_error_mgr jerr;
     FILE *infile;
@@ -113,6 +137,7 @@ MyImage* load_jpeg(const char *filename) {
     if (cinfo.jpeg_color_space != JCS_GRAYSCALE) {
         cinfo.out_color_space = JCS_GRAYSCALE;
     }
+    cinfo.dct_method = settings->fast_dct ? JDCT_IFAST : JDCT_ISLOW;
     
     jpeg_start_decompress(&cinfo);
     img = create_image(cinfo.output_width, cinfo.output_height);
@@ -131,6 +156,53 @@ MyImage* load_jpeg(const char *filename) {
     fclose(infile);
     jpeg_destroy_decompress(&cinfo);
     
-    printf("Loaded JPEG image from %s (%dx%d)\n", filename, img->width, img->height);
+    printf("Loaded JPEG image from %s (%dx%d, profile: %s)\n", filename, img->width, img->height, settings->name);
     return img;
 }
+
+int read_jpeg_quant_table(const char *filename, unsigned short qtable[64]) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    FILE *infile;
+    
+    if ((infile = fopen(filename, "rb")) == NULL) {
+        printf("Error: Cannot open JPEG file %s\n", filename);
+        return 0;
+    }
+    
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, infile);
+    jpeg_read_header(&cinfo, TRUE);
+    
+    // The luminance component uses the table of the first component
+    int table = cinfo.comp_info[0].quant_tbl_no;
+    int found = cinfo.quant_tbl_ptrs[table] != NULL;
+    if (found) {
+        for (int i = 0; i < 64; i++) {
+            qtable[i] = cinfo.quant_tbl_ptrs[table]->quantval[i];
+        }
+    }
+    
+    jpeg_destroy_decompress(&cinfo);
+    fclose(infile);
+    return found;
+}
+
+void quality_quant_table(int quality, unsigned short qtable[64]) {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    
+    // Let libjpeg scale its standard table exactly as save_jpeg would
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    cinfo.in_color_space = JCS_GRAYSCALE;
+    cinfo.input_components = 1;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    
+    for (int i = 0; i < 64; i++) {
+        qtable[i] = cinfo.quant_tbl_ptrs[0]->quantval[i];
+    }
+    jpeg_destroy_compress(&cinfo);
+}
@@ -4,6 +4,23 @@
 #define ENCODE 1
 #define EXTRACT 1
 #define TEST_ATTACKS 1
+#define PROFILE_REPORT 1
+#define TEST_PARALLEL_CODEC 1
+#define TEST_REMARK 1
+#define TRACE_RECIPIENTS 1
+#define AUTO_ALPHA 1
+
+// Re-compression quality the watermark must survive in auto-strength mode
+#define TARGET_QUALITY 50
+
+// Fingerprint index of issued payloads (built with the fpindex tool)
+#define TRACE_INDEX "recipients.fpidx"
+
+// Codec profile used by each pipeline stage
+#define INPUT_PROFILE CODEC_PROFILE_DEFAULT     // Loading the input image
+#define OUTPUT_PROFILE CODEC_PROFILE_DELIVER    // Watermarked output handed to the user
+#define ATTACK_PROFILE CODEC_PROFILE_SIMULATE   // Re-compression attack (discarded)
+#define DEBUG_PROFILE CODEC_PROFILE_SIMULATE    // Attacked copies saved for inspection
 
 int main(int argc, char *argv[]) {
     // printf("JPEG library version: %d\n", JPEG_LIB_VERSION);
@@ -35,7 +52,7 @@ int main(int argc, char *argv[]) {
 
     MyImage *original = NULL;
     if (is_jpg) {
-        original = load_jpeg(filename);
+        original = load_jpeg_profile(filename, INPUT_PROFILE);
     } else {
         // Convert to JPEG for processing
         original = convert_to_jpeg(filename, temp_jpeg);
@@ -74,17 +91,38 @@ int main(int argc, char *argv[]) {
     
 #if ENCODE    
     // Embed watermark
+#if AUTO_ALPHA
+    // Derive the strength from the target quality's table, and the input's own
+    // table when it is coarser, instead of trial embed/attack/extract loops
+    unsigned short qtable[64];
+    unsigned short input_qtable[64];
+    quality_quant_table(TARGET_QUALITY, qtable);
+    if (is_jpg && read_jpeg_quant_table(filename, input_qtable)) {
+        for (int i = 0; i < 64; i++) {
+            if (input_qtable[i] > qtable[i]) qtable[i] = input_qtable[i];
+        }
+    }
+    double alpha = alpha_from_quant_table(qtable);
+    printf("Embedding watermark with auto strength alpha = %.1f (target quality %d)\n",
+           alpha, TARGET_QUALITY);
+    WatermarkIndex *index = embed_watermark_indexed_auto(watermarked, watermark, watermark_length, qtable);
+#else
     double alpha = 50.0; // Embedding strength
     printf("Embedding watermark with strength alpha = %.1f\n", alpha);
-    embed_watermark(watermarked, watermark, watermark_length, alpha);
+    WatermarkIndex *index = embed_watermark_indexed(watermarked, watermark, watermark_length, alpha);
+#endif
     printf("Watermark embedded successfully!\n");
     
+    // Keep the block index next to the master so recipient variants can be re-marked
+    save_watermark_index(index, "watermarked_image.wmidx");
+    free_watermark_index(index);
+    
     // Save watermarked image
     if (is_jpg) {
-        save_jpeg(watermarked, "watermarked_image.jpg", 90);
+        save_jpeg_profile(watermarked, "watermarked_image.jpg", 90, OUTPUT_PROFILE);
         strcpy(output_file, "watermarked_image.jpg");
     } else {
-        save_jpeg(watermarked, temp_out_jpeg, 90);
+        save_jpeg_profile(watermarked, temp_out_jpeg, 90, OUTPUT_PROFILE);
         // Reconvert to original format
         snprintf(reconverted_file, sizeof(reconverted_file), "watermarked_image%s", ext);
         if (!convert_from_jpeg(temp_out_jpeg, reconverted_file, ext+1)) {
@@ -99,7 +137,7 @@ int main(int argc, char *argv[]) {
 #if EXTRACT
     
     // Extract watermark from watermarked image
-    char extracted_watermark[(strlen(watermark) + 7) / 8 + 1];
+    char extracted_watermark[(watermark_length + 7) / 8 + 1];
     memset(extracted_watermark, 0, sizeof(extracted_watermark));
     
     printf("\nExtracting watermark from clean watermarked image...\n");
@@ -133,7 +171,7 @@ int main(int argc, char *argv[]) {
     MyImage *noisy = attack_noise(watermarked, 10);
     
     // Save noisy image
-    save_jpeg(noisy, "noisy_watermarked_image.jpg", 90);
+    save_jpeg_profile(noisy, "noisy_watermarked_image.jpg", 90, DEBUG_PROFILE);
     
     // Extract watermark from noisy image
     memset(extracted_watermark, 0, sizeof(extracted_watermark));
@@ -158,10 +196,10 @@ int main(int argc, char *argv[]) {
     printf("\nTesting robustness with JPEG compression...\n");
     
     // Apply quality attack
-    MyImage *jpeg_compressed = attack_quality(watermarked, 50);
+    MyImage *jpeg_compressed = attack_quality_profile(watermarked, TARGET_QUALITY, ATTACK_PROFILE);
     
     if (jpeg_compressed) {
-        save_jpeg(jpeg_compressed, "jpeg_compressed_watermarked.jpg", 90);
+        save_jpeg_profile(jpeg_compressed, "jpeg_compressed_watermarked.jpg", 90, DEBUG_PROFILE);
         
         // Extract watermark from JPEG compressed image
         memset(extracted_watermark, 0, sizeof(extracted_watermark));
@@ -182,18 +220,189 @@ int main(int argc, char *argv[]) {
         similarity = calculate_similarity(watermark, extracted_watermark, watermark_length);
         printf("Similarity after JPEG compression: %.2f%%\n", similarity * 100);
         
+#if TRACE_RECIPIENTS
+        // Trace the recovered payload back to the closest issued recipients
+        FILE *trace_probe = fopen(TRACE_INDEX, "rb");
+        if (trace_probe) {
+            fclose(trace_probe);
+            FingerprintIndex *trace_index = fingerprint_index_open(TRACE_INDEX);
+            if (trace_index && trace_index->payload_bits == watermark_length) {
+                FingerprintMatch matches[3];
+                int found = fingerprint_index_search(trace_index, extracted_watermark,
+                                                     watermark_length / 4, matches, 3);
+                printf("Closest recipients in %s:\n", TRACE_INDEX);
+                for (int m = 0; m < found; m++) {
+                    printf("  recipient %llu: %d bit errors\n",
+                           (unsigned long long)matches[m].recipient_id, matches[m].distance);
+                }
+            }
+            if (trace_index) fingerprint_index_close(trace_index);
+        }
+#endif
+        
         free_image(jpeg_compressed);
     }
     
+    // Test the in-memory attacks that keep the image size
+    printf("\nTesting robustness with in-memory attacks...\n");
+    MyImage *attacked = create_image(watermarked->width, watermarked->height);
+    const char *attack_names[] = { "gaussian", "blur", "sharpen", "scale" };
+    for (int a = 0; a < 4; a++) {
+        int ok = 0;
+        if (a == 0) {
+            ok = attack_gaussian_into(watermarked, attacked, 5.0, ATTACK_SEED);
+        } else if (a == 1) {
+            ok = attack_blur_into(watermarked, attacked);
+        } else if (a == 2) {
+            ok = attack_sharpen_into(watermarked, attacked, 1.0);
+        } else {
+            // Downscale by half and back to the original size
+            MyImage *half = attack_scale(watermarked, 0.5);
+            ok = half && attack_scale_into(half, attacked);
+            if (half) free_image(half);
+        }
+        if (!ok) continue;
+        
+        memset(extracted_watermark, 0, sizeof(extracted_watermark));
+        extract_watermark(attacked, extracted_watermark, watermark_length);
+        similarity = calculate_similarity(watermark, extracted_watermark, watermark_length);
+        printf("Similarity after %s: %.2f%%\n", attack_names[a], similarity * 100);
+    }
+    free_image(attacked);
+    
     // Remove temporary file
     remove("temp_low_quality.jpg");
     
     free_image(noisy);
 #endif
+
+#if PROFILE_REPORT
+    
+    // Report how each codec profile changes extraction accuracy after re-compression
+    printf("\nCodec profile report (JPEG quality %d re-compression)...\n", TARGET_QUALITY);
+    double profile_similarity[NUM_CODEC_PROFILES];
+    for (int p = 0; p < NUM_CODEC_PROFILES; p++) {
+        profile_similarity[p] = -1.0;
+        MyImage *recompressed = attack_quality_profile(watermarked, TARGET_QUALITY, (CodecProfile)p);
+        if (!recompressed) continue;
+        
+        char profile_watermark[(watermark_length + 7) / 8 + 1];
+        memset(profile_watermark, 0, sizeof(profile_watermark));
+        extract_watermark(recompressed, profile_watermark, watermark_length);
+        profile_similarity[p] = calculate_similarity(watermark, profile_watermark, watermark_length);
+        free_image(recompressed);
+    }
+    
+    printf("%-10s %-7s %-9s %-12s %-8s %s\n",
+           "Profile", "DCT", "Optimize", "Progressive", "Restart", "Similarity");
+    for (int p = 0; p < NUM_CODEC_PROFILES; p++) {
+        const CodecSettings *settings = get_codec_settings((CodecProfile)p);
+        printf("%-10s %-7s %-9s %-12s %-8d ",
+               settings->name,
+               settings->fast_dct ? "ifast" : "islow",
+               settings->optimize_coding ? "yes" : "no",
+               settings->progressive ? "yes" : "no",
+               settings->restart_rows);
+        if (profile_similarity[p] < 0) {
+            printf("failed\n");
+        } else {
+            printf("%.2f%%\n", profile_similarity[p] * 100);
+        }
+    }
+#endif
+    
+#if TEST_REMARK && ENCODE
+    
+    // Re-mark copies of the master for other recipients, touching only the
+    // blocks whose bits differ. The index is read-only, so it serves both.
+    printf("\nTesting incremental re-marking...\n");
+    char *new_watermarks[] = { "WATERMARK_TEST_456", "WATERMARK_TEST_789" };
+    WatermarkIndex *remark_index = load_watermark_index("watermarked_image.wmidx");
+    if (remark_index) {
+        MyImage *remarked = NULL;
+        for (int v = 0; v < 2; v++) {
+            char *new_watermark = new_watermarks[v];
+            if (remarked) free_image(remarked);
+            remarked = copy_image(watermarked);
+            int touched = remark_watermark(remarked, remark_index, new_watermark);
+            printf("Re-marked with \"%s\": %d of %d blocks touched\n",
+                   new_watermark, touched, remark_index->num_entries);
+            
+            char remark_extracted[(watermark_length + 7) / 8 + 1];
+            memset(remark_extracted, 0, sizeof(remark_extracted));
+            extract_watermark(remarked, remark_extracted, watermark_length);
+            similarity = calculate_similarity(new_watermark, remark_extracted, watermark_length);
+            printf("Similarity to new watermark: %.2f%%\n", similarity * 100);
+            
+            // A re-mark must give the same pixels as marking the original afresh
+            MyImage *fresh = copy_image(original);
+#if AUTO_ALPHA
+            embed_watermark_auto(fresh, new_watermark, watermark_length, qtable);
+#else
+            embed_watermark(fresh, new_watermark, watermark_length, alpha);
+#endif
+            int rows_differ = 0;
+            for (int i = 0; i < fresh->height; i++) {
+                if (memcmp(fresh->data[i], remarked->data[i], fresh->width) != 0) rows_differ++;
+            }
+            printf("Re-mark matches fresh embed: %s (%d rows differ)\n",
+                   rows_differ == 0 ? "yes" : "no", rows_differ);
+            free_image(fresh);
+        }
+        
+        // Roll back the last variant to the unmarked original from the recorded block pixels
+        rollback_watermark(remarked, remark_index);
+        int max_diff = 0;
+        for (int i = 0; i < original->height; i++) {
+            for (int j = 0; j < original->width; j++) {
+                int diff = abs((int)remarked->data[i][j] - (int)original->data[i][j]);
+                if (diff > max_diff) max_diff = diff;
+            }
+        }
+        printf("Max pixel difference from original after rollback: %d\n", max_diff);
+        
+        free_image(remarked);
+        free_watermark_index(remark_index);
+    }
+#endif
+
+#if TEST_PARALLEL_CODEC
+    
+    // Round-trip through the banded encoder and restart-segmented decoder. The
+    // band and thread counts are explicit so stitching and segmentation run
+    // even in a build without OpenMP (they just run serially there)
+    printf("\nTesting parallel JPEG codec...\n");
+    char temp_parallel[] = "__temp_parallel.jpg";
+    if (save_jpeg_parallel(watermarked, temp_parallel, 90, 4)) {
+        MyImage *serial_decoded = load_jpeg(temp_parallel);
+        MyImage *parallel_decoded = load_jpeg_parallel(temp_parallel, 4);
+        if (!serial_decoded || !parallel_decoded) {
+            printf("Error: Failed to decode %s\n", temp_parallel);
+        } else if (serial_decoded->width != parallel_decoded->width ||
+                   serial_decoded->height != parallel_decoded->height) {
+            printf("Parallel decode matches serial decode: no (%dx%d vs %dx%d)\n",
+                   parallel_decoded->width, parallel_decoded->height,
+                   serial_decoded->width, serial_decoded->height);
+        } else {
+            int rows_differ = 0;
+            for (int i = 0; i < serial_decoded->height; i++) {
+                if (memcmp(serial_decoded->data[i], parallel_decoded->data[i], serial_decoded->width) != 0) {
+                    rows_differ++;
+                }
+            }
+            printf("Parallel decode matches serial decode: %s (%d rows differ)\n",
+                   rows_differ == 0 ? "yes" : "no", rows_differ);
+        }
+        if (serial_decoded) free_image(serial_decoded);
+        if (parallel_decoded) free_image(parallel_decoded);
+    }
+    remove(temp_parallel);
+#endif
     
     printf("\nGenerated files:\n");
     // printf("- original_test_image.jpg (original test image)\n");
     printf("- watermarked_image.jpg (image with embedded watermark)\n");
+    printf("- watermarked_image.wmidx (block index for re-marking; keep private)\n");
 #if TEST_ATTACKS
     printf("- noisy_watermarked_image.jpg (watermarked image with noise)\n");
     printf("- jpeg_compressed_watermarked.jpg (watermarked image after JPEG compression)\n");
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jpeglib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "parallel_jpeg.h"
+#include "dct.h"
+
+#define MARKER_SOF0 0xC0  // Baseline DCT
+#define MARKER_SOF1 0xC1  // Extended sequential DCT
+#define MARKER_RST0 0xD0
+#define MARKER_SOI 0xD8
+#define MARKER_EOI 0xD9
+#define MARKER_SOS 0xDA
+#define MARKER_DRI 0xDD
+
+// Layout of a sequential JPEG, as far as restart segmentation needs it
+typedef struct {
+    long sof_offset;        // Offset of the SOF marker
+    long data_offset;       // First byte of entropy-coded data (after SOS)
+    int sof_type;
+    int width;
+    int height;
+    int num_components;
+    int scan_components;
+    int mcu_width;
+    int mcu_height;
+    int restart_interval;   // In MCUs, 0 if no DRI segment
+} jpeg_layout_t;
+
+static int default_threads(void) {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+static int read_u16(const unsigned char *p) {
+    return (p[0] << 8) | p[1];
+}
+
+// Walk the marker segments up to the start of scan. Returns 1 on success.
+static int parse_layout(const unsigned char *buf, long size, jpeg_layout_t *layout) {
+    memset(layout, 0, sizeof(*layout));
+    if (size < 4 || buf[0] != 0xFF || buf[1] != MARKER_SOI) return 0;
+
+    int max_h = 1, max_v = 1;
+    long pos = 2;
+    while (pos + 4 <= size) {
+        if (buf[pos] != 0xFF) return 0;
+        int marker = buf[pos + 1];
+        if (marker == 0xFF) {  // Fill byte
+            pos++;
+            continue;
+        }
+        int length = read_u16(buf + pos + 2);
+        if (length < 2 || pos + 2 + length > size) return 0;
+        const unsigned char *seg = buf + pos + 4;
+
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            // Header fields plus three bytes per component must fit in the segment
+            if (length < 8 || length < 8 + 3 * seg[5]) return 0;
+            layout->sof_offset = pos;
+            layout->sof_type = marker;
+            layout->height = read_u16(seg + 1);
+            layout->width = read_u16(seg + 3);
+            layout->num_components = seg[5];
+            for (int c = 0; c < layout->num_components; c++) {
+                int h = seg[7 + 3 * c] >> 4;
+                int v = seg[7 + 3 * c] & 0x0F;
+                if (h > max_h) max_h = h;
+                if (v > max_v) max_v = v;
+            }
+        } else if (marker == MARKER_DRI) {
+            if (length < 4) return 0;
+            layout->restart_interval = read_u16(seg);
+        } else if (marker == MARKER_SOS) {
+            if (length < 3) return 0;
+            layout->scan_components = seg[0];
+            layout->data_offset = pos + 2 + length;
+            break;
+        }
+        pos += 2 + length;
+    }
+    if (layout->data_offset == 0 || layout->sof_offset == 0) return 0;
+
+    // A single-component scan is non-interleaved: one block per MCU
+    if (layout->num_components == 1) {
+        max_h = max_v = 1;
+    }
+    layout->mcu_width = BLOCK_SIZE * max_h;
+    layout->mcu_height = BLOCK_SIZE * max_v;
+    return 1;
+}
+
+// Copy entropy-coded bytes, renumbering restart markers from *next_restart
+static unsigned char* copy_renumbered(unsigned char *out, const unsigned char *in, long length,
+                                      int *next_restart) {
+    for (long i = 0; i < length; i++) {
+        if (in[i] == 0xFF && i + 1 < length &&
+            in[i + 1] >= MARKER_RST0 && in[i + 1] <= MARKER_RST0 + 7) {
+            *out++ = 0xFF;
+            *out++ = (unsigned char)(MARKER_RST0 + (*next_restart)++ % 8);
+            i++;
+        } else {
+            *out++ = in[i];
+        }
+    }
+    return out;
+}
+
+int save_jpeg_parallel(MyImage *img, const char *filename, int quality, int num_bands) {
+    if (num_bands <= 0) num_bands = default_threads();
+
+    // Bands must start on an MCU row so that each one begins at a restart
+    int band_rows = (img->height + num_bands - 1) / num_bands;
+    band_rows = (band_rows + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    num_bands = (img->height + band_rows - 1) / band_rows;
+
+    unsigned char **band_data = (unsigned char**)calloc(num_bands, sizeof(unsigned char*));
+    unsigned long *band_size = (unsigned long*)calloc(num_bands, sizeof(unsigned long));
+    const CodecSettings *settings = get_codec_settings(CODEC_PROFILE_STREAM);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int b = 0; b < num_bands; b++) {
+        struct jpeg_compress_struct cinfo;
+        struct jpeg_error_mgr jerr;
+        int y0 = b * band_rows;
+        int rows = (y0 + band_rows > img->height) ? img->height - y0 : band_rows;
+
+        cinfo.err = jpeg_std_error(&jerr);
+        jpeg_create_compress(&cinfo);
+        jpeg_mem_dest(&cinfo, &band_data[b], &band_size[b]);
+        cinfo.image_width = img->width;
+        cinfo.image_height = rows;
+        cinfo.input_components = 1;
+        cinfo.in_color_space = JCS_GRAYSCALE;
+
+        // Standard Huffman tables and identical quantization keep the bands compatible
+        jpeg_set_defaults(&cinfo);
+        jpeg_set_quality(&cinfo, quality, TRUE);
+        cinfo.dct_method = settings->fast_dct ? JDCT_IFAST : JDCT_ISLOW;
+        cinfo.optimize_coding = FALSE;
+        cinfo.restart_in_rows = settings->restart_rows;
+        jpeg_start_compress(&cinfo, TRUE);
+
+        while (cinfo.next_scanline < cinfo.image_height) {
+            jpeg_write_scanlines(&cinfo, &img->data[y0 + cinfo.next_scanline],
+                                 cinfo.image_height - cinfo.next_scanline);
+        }
+
+        jpeg_finish_compress(&cinfo);
+        jpeg_destroy_compress(&cinfo);
+    }
+
+    // Stitch: headers of band 0 (with the full height), then every band's scan
+    // data joined by restart markers, then EOI
+    int success = 0;
+    FILE *outfile = NULL;
+    unsigned long total = 2;
+    for (int b = 0; b < num_bands; b++) total += band_size[b] + 2;
+    unsigned char *out = (unsigned char*)malloc(total);
+    unsigned char *p = out;
+    int next_restart = 0;
+
+    for (int b = 0; b < num_bands; b++) {
+        jpeg_layout_t layout;
+        if (!parse_layout(band_data[b], (long)band_size[b], &layout)) {
+            printf("Error: Failed to parse encoded band %d\n", b);
+            goto cleanup;
+        }
+        if (b == 0) {
+            memcpy(p, band_data[0], layout.data_offset);
+            p[layout.sof_offset + 5] = (unsigned char)(img->height >> 8);
+            p[layout.sof_offset + 6] = (unsigned char)(img->height & 0xFF);
+            p += layout.data_offset;
+        } else {
+            *p++ = 0xFF;
+            *p++ = (unsigned char)(MARKER_RST0 + next_restart++ % 8);
+        }
+        // Drop the band's trailing EOI
+        p = copy_renumbered(p, band_data[b] + layout.data_offset,
+                            (long)band_size[b] - 2 - layout.data_offset, &next_restart);
+    }
+    *p++ = 0xFF;
+    *p++ = MARKER_EOI;
+
+    if ((outfile = fopen(filename, "wb")) == NULL) {
+        printf("Error: Cannot create JPEG file %s\n", filename);
+        goto cleanup;
+    }
+    fwrite(out, 1, p - out, outfile);
+    fclose(outfile);
+    success = 1;
+    printf("Saved JPEG image as %s (quality: %d, %d parallel bands)\n", filename, quality, num_bands);
+
+cleanup:
+    for (int b = 0; b < num_bands; b++) free(band_data[b]);
+    free(band_data);
+    free(band_size);
+    free(out);
+    return success;
+}
+
+MyImage* load_jpeg_parallel(const char *filename, int num_threads) {
+    FILE *infile;
+    if (num_threads <= 0) num_threads = default_threads();
+
+    if ((infile = fopen(filename, "rb")) == NULL) {
+        printf("Error: Cannot open JPEG file %s\n", filename);
+        return NULL;
+    }
+    fseek(infile, 0, SEEK_END);
+    long size = ftell(infile);
+    fseek(infile, 0, SEEK_SET);
+    unsigned char *buf = (unsigned char*)malloc(size);
+    if (fread(buf, 1, size, infile) != (size_t)size) {
+        printf("Error: Failed to read JPEG file %s\n", filename);
+        fclose(infile);
+        free(buf);
+        return NULL;
+    }
+    fclose(infile);
+
+    // Only single-scan sequential files with restarts on MCU row boundaries split cleanly
+    jpeg_layout_t layout;
+    if (num_threads == 1 || !parse_layout(buf, size, &layout) ||
+        (layout.sof_type != MARKER_SOF0 && layout.sof_type != MARKER_SOF1) ||
+        layout.scan_components != layout.num_components || layout.height == 0) {
+        free(buf);
+        return load_jpeg(filename);
+    }
+    int mcus_per_row = (layout.width + layout.mcu_width - 1) / layout.mcu_width;
+    int mcu_rows = (layout.height + layout.mcu_height - 1) / layout.mcu_height;
+    if (layout.restart_interval == 0 || layout.restart_interval % mcus_per_row != 0) {
+        free(buf);
+        return load_jpeg(filename);
+    }
+    int rows_per_segment = layout.restart_interval / mcus_per_row * layout.mcu_height;
+
+    // Locate the restart segments: [seg_start[k], seg_end[k]) excludes the markers
+    int max_segments = (mcu_rows * layout.mcu_height + rows_per_segment - 1) / rows_per_segment;
+    long *seg_start = (long*)malloc((max_segments + 1) * sizeof(long));
+    long *seg_end = (long*)malloc((max_segments + 1) * sizeof(long));
+    int num_segments = 0;
+    seg_start[0] = layout.data_offset;
+    for (long i = layout.data_offset; i + 1 < size; i++) {
+        if (buf[i] != 0xFF || buf[i + 1] == 0x00 || buf[i + 1] == 0xFF) continue;
+        int marker = buf[i + 1];
+        if (num_segments >= max_segments) break;
+        seg_end[num_segments++] = i;
+        if (marker < MARKER_RST0 || marker > MARKER_RST0 + 7) break;
+        seg_start[num_segments] = i + 2;
+        i++;
+    }
+    if (num_segments != max_segments) {
+        free(seg_start);
+        free(seg_end);
+        free(buf);
+        return load_jpeg(filename);
+    }
+
+    int num_chunks = num_threads < num_segments ? num_threads : num_segments;
+    MyImage *img = create_image(layout.width, layout.height);
+
+    // Each chunk is decoded as a standalone JPEG: the original headers with the
+    // chunk height patched in, its segments renumbered from RST0, and an EOI
+    #pragma omp parallel for schedule(static)
+    for (int c = 0; c < num_chunks; c++) {
+        int first = (int)((long)num_segments * c / num_chunks);
+        int last = (int)((long)num_segments * (c + 1) / num_chunks);
+        int y0 = first * rows_per_segment;
+        int y1 = last * rows_per_segment;
+        if (y1 > layout.height) y1 = layout.height;
+
+        long length = layout.data_offset + 2;
+        for (int k = first; k < last; k++) length += seg_end[k] - seg_start[k] + 2;
+        unsigned char *chunk = (unsigned char*)malloc(length);
+        unsigned char *p = chunk;
+        memcpy(p, buf, layout.data_offset);
+        p[layout.sof_offset + 5] = (unsigned char)((y1 - y0) >> 8);
+        p[layout.sof_offset + 6] = (unsigned char)((y1 - y0) & 0xFF);
+        p += layout.data_offset;
+        for (int k = first; k < last; k++) {
+            if (k > first) {
+                *p++ = 0xFF;
+                *p++ = (unsigned char)(MARKER_RST0 + (k - first - 1) % 8);
+            }
+            memcpy(p, buf + seg_start[k], seg_end[k] - seg_start[k]);
+            p += seg_end[k] - seg_start[k];
+        }
+        *p++ = 0xFF;
+        *p++ = MARKER_EOI;
+
+        struct jpeg_decompress_struct cinfo;
+        struct jpeg_error_mgr jerr;
+        cinfo.err = jpeg_std_error(&jerr);
+        jpeg_create_decompress(&cinfo);
+        jpeg_mem_src(&cinfo, chunk, p - chunk);
+        jpeg_read_header(&cinfo, TRUE);
+        if (cinfo.jpeg_color_space != JCS_GRAYSCALE) {
+            cinfo.out_color_space = JCS_GRAYSCALE;
+        }
+        jpeg_start_decompress(&cinfo);
+        while (cinfo.output_scanline < cinfo.output_height) {
+            jpeg_read_scanlines(&cinfo, &img->data[y0 + cinfo.output_scanline],
+                                cinfo.output_height - cinfo.output_scanline);
+        }
+        jpeg_finish_decompress(&cinfo);
+        jpeg_destroy_decompress(&cinfo);
+        free(chunk);
+    }
+
+    free(seg_start);
+    free(seg_end);
+    free(buf);
+    printf("Loaded JPEG image from %s (%dx%d, %d parallel segments)\n",
+           filename, img->width, img->height, num_chunks);
+    return img;
+}
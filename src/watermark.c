@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
 #include "watermark.h"
 #include "dct.h"
 #include "image.h"
@@ -13,121 +14,497 @@ void generate_sequence(int *sequence, int length, int seed) {
     }
 }
 
-void embed_watermark(MyImage *img, char *watermark, int watermark_length, double alpha) {
-    int blocks_x = img->width / BLOCK_SIZE;
-    int blocks_y = img->height / BLOCK_SIZE;
-    int total_blocks = blocks_x * blocks_y;
+#define CLAMP_PASSES 4  // Extra passes to restore separation lost to pixel clamping
+#define ROUNDING_MARGIN 1.155  // 4 sigma of a coefficient's error from rounding pixels (sigma = 1/sqrt(12))
+#define TIE_EPSILON 1e-6  // Pairs closer than this are tied; their order is summation noise
+
+// Plan cache: the PLAN_CACHE_SIZE most recently used plans
+static EmbedPlan *plan_cache[PLAN_CACHE_SIZE];
+static unsigned long plan_last_used[PLAN_CACHE_SIZE];
+static unsigned long plan_clock = 0;
+
+// Orthonormal 8x8 DCT basis function for coefficient (u,v)
+static void dct_basis(int u, int v, double basis[BLOCK_SIZE][BLOCK_SIZE]) {
+    double alpha_u = (u == 0) ? sqrt(1.0/BLOCK_SIZE) : sqrt(2.0/BLOCK_SIZE);
+    double alpha_v = (v == 0) ? sqrt(1.0/BLOCK_SIZE) : sqrt(2.0/BLOCK_SIZE);
     
-    int *block_sequence = (int*)malloc(total_blocks * sizeof(int));
-    generate_sequence(block_sequence, total_blocks, 12345);
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        for (int j = 0; j < BLOCK_SIZE; j++) {
+            basis[i][j] = alpha_u * alpha_v *
+                          cos((2*i + 1) * PI * u / (2.0 * BLOCK_SIZE)) *
+                          cos((2*j + 1) * PI * v / (2.0 * BLOCK_SIZE));
+        }
+    }
+}
+
+static EmbedPlan* build_plan(int width, int height, int seed, int watermark_length) {
+    int blocks_x = width / BLOCK_SIZE;
+    int total_blocks = blocks_x * (height / BLOCK_SIZE);
     
-    double block[BLOCK_SIZE][BLOCK_SIZE];
-    double dct_block[BLOCK_SIZE][BLOCK_SIZE];
+    EmbedPlan *plan = (EmbedPlan*)malloc(sizeof(EmbedPlan));
+    plan->width = width;
+    plan->height = height;
+    plan->seed = seed;
+    plan->watermark_length = watermark_length;
+    plan->num_bits = watermark_length < total_blocks ? watermark_length : total_blocks;
+    plan->block = (int*)malloc((plan->num_bits + 1) * sizeof(int));
+    plan->row = (int*)malloc((plan->num_bits + 1) * sizeof(int));
+    plan->col = (int*)malloc((plan->num_bits + 1) * sizeof(int));
     
-    int watermark_bit = 0;
+    if (total_blocks > 0) {
+        int *block_sequence = (int*)malloc(total_blocks * sizeof(int));
+        generate_sequence(block_sequence, total_blocks, seed);
+        for (int k = 0; k < plan->num_bits; k++) {
+            plan->block[k] = block_sequence[k];
+            plan->row[k] = (block_sequence[k] / blocks_x) * BLOCK_SIZE;
+            plan->col[k] = (block_sequence[k] % blocks_x) * BLOCK_SIZE;
+        }
+        free(block_sequence);
+    }
     
-    for (int block_idx = 0; block_idx < total_blocks && watermark_bit < watermark_length; block_idx++) {
-        int selected_block = block_sequence[block_idx];
-        int block_y = selected_block / blocks_x;
-        int block_x = selected_block % blocks_x;
+    dct_basis(3, 4, plan->basis_34);
+    dct_basis(4, 3, plan->basis_43);
+    return plan;
+}
+
+static void free_plan(EmbedPlan *plan) {
+    free(plan->block);
+    free(plan->row);
+    free(plan->col);
+    free(plan);
+}
+
+EmbedPlan* get_embed_plan(int width, int height, int seed, int watermark_length) {
+    int slot = 0;
+    plan_clock++;
+    
+    for (int s = 0; s < PLAN_CACHE_SIZE; s++) {
+        EmbedPlan *plan = plan_cache[s];
+        if (plan && plan->width == width && plan->height == height &&
+            plan->seed == seed && plan->watermark_length == watermark_length) {
+            plan_last_used[s] = plan_clock;
+            return plan;
+        }
+        // Prefer an empty slot, otherwise evict the least recently used plan
+        if (plan_cache[slot] && (!plan || plan_last_used[s] < plan_last_used[slot])) {
+            slot = s;
+        }
+    }
+    
+    if (plan_cache[slot]) free_plan(plan_cache[slot]);
+    plan_cache[slot] = build_plan(width, height, seed, watermark_length);
+    plan_last_used[slot] = plan_clock;
+    return plan_cache[slot];
+}
+
+void clear_embed_plans(void) {
+    for (int s = 0; s < PLAN_CACHE_SIZE; s++) {
+        if (plan_cache[s]) free_plan(plan_cache[s]);
+        plan_cache[s] = NULL;
+    }
+}
+
+// Project the block at (row, col) onto the (3,4) and (4,3) basis functions
+static void gather_pair(const EmbedPlan *plan, MyImage *img, int row, int col,
+                        double *c34, double *c43) {
+    double sum_34 = 0.0, sum_43 = 0.0;
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        const unsigned char *pixels = img->data[row + i] + col;
+        for (int j = 0; j < BLOCK_SIZE; j++) {
+            sum_34 += pixels[j] * plan->basis_34[i][j];
+            sum_43 += pixels[j] * plan->basis_43[i][j];
+        }
+    }
+    *c34 = sum_34;
+    *c43 = sum_43;
+}
+
+// Add the coefficient changes back into the pixels (round and clamp)
+static void scatter_delta(const EmbedPlan *plan, MyImage *img, int row, int col,
+                          double delta_34, double delta_43) {
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        unsigned char *pixels = img->data[row + i] + col;
+        for (int j = 0; j < BLOCK_SIZE; j++) {
+            int pixel_val = (int)round(pixels[j] + delta_34 * plan->basis_34[i][j] +
+                                       delta_43 * plan->basis_43[i][j]);
+            if (pixel_val < 0) pixel_val = 0;
+            if (pixel_val > 255) pixel_val = 255;
+            pixels[j] = (unsigned char)pixel_val;
+        }
+    }
+}
+
+// Order the (3,4)/(4,3) coefficient pair so that it encodes bit. A tied pair
+// has no order (only floating-point noise), so it is always spread. With
+// auto_strength set, a correctly ordered pair closer than 2*alpha is also
+// spread, so the order survives re-quantization.
+static void embed_pair(double *c34, double *c43, int bit, double alpha, int auto_strength) {
+    double margin = auto_strength ? 2.0 * alpha : 0.0;
+    double order = bit ? *c34 - *c43 : *c43 - *c34;
+    if (order <= margin || fabs(order) < TIE_EPSILON) {
+        double avg = (*c34 + *c43) / 2.0;
+        *c34 = bit ? avg + alpha : avg - alpha;
+        *c43 = bit ? avg - alpha : avg + alpha;
+    }
+}
+
+// Clamping at 0 or 255 eats into the separation in very dark or bright
+// blocks; push the unclamped pixels further to win it back
+static void restore_separation(const EmbedPlan *plan, MyImage *img, int row, int col, int bit, double alpha) {
+    for (int pass = 0; pass < CLAMP_PASSES; pass++) {
+        double c34, c43;
+        gather_pair(plan, img, row, col, &c34, &c43);
+        double shortfall = 2.0 * alpha - (bit ? c34 - c43 : c43 - c34);
+        if (shortfall <= 0.5) break;
+        double step = bit ? shortfall / 2.0 : -shortfall / 2.0;
+        scatter_delta(plan, img, row, col, step, -step);
+    }
+}
+
+static int get_bit(char *watermark, int bit) {
+    return (watermark[bit / 8] >> (7 - (bit % 8))) & 1;
+}
+
+// Embeds one bit into the block at (row, col)
+static void embed_block_bit(const EmbedPlan *plan, MyImage *img, int row, int col, int bit,
+                            double alpha, int auto_strength) {
+    double c34, c43;
+    gather_pair(plan, img, row, col, &c34, &c43);
+    
+    double new_34 = c34, new_43 = c43;
+    embed_pair(&new_34, &new_43, bit, alpha, auto_strength);
+    if (new_34 != c34 || new_43 != c43) {
+        scatter_delta(plan, img, row, col, new_34 - c34, new_43 - c43);
+    }
+    if (auto_strength) {
+        restore_separation(plan, img, row, col, bit, alpha);
+    }
+}
+
+static void save_block(MyImage *img, int row, int col, unsigned char *pixels) {
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        memcpy(pixels + i * BLOCK_SIZE, img->data[row + i] + col, BLOCK_SIZE);
+    }
+}
+
+static void restore_block(MyImage *img, int row, int col, const unsigned char *pixels) {
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        memcpy(img->data[row + i] + col, pixels + i * BLOCK_SIZE, BLOCK_SIZE);
+    }
+}
+
+// Chains each record to the next record on the same block
+static void link_index(WatermarkIndex *index, int total_blocks) {
+    int *last = (int*)malloc((total_blocks + 1) * sizeof(int));
+    for (int b = 0; b < total_blocks; b++) {
+        last[b] = -1;
+    }
+    for (int k = index->num_entries - 1; k >= 0; k--) {
+        WatermarkIndexEntry *entry = &index->entries[k];
+        entry->next = last[entry->block];
+        last[entry->block] = k;
+    }
+    free(last);
+}
+
+// Embeds the watermark and, when index is non-NULL, records each bit's block
+// and the original pixels of every block it marks
+static void embed_bits(MyImage *img, const EmbedPlan *plan, char *watermark, double alpha,
+                       int auto_strength, WatermarkIndex *index) {
+    int total_blocks = (img->width / BLOCK_SIZE) * (img->height / BLOCK_SIZE);
+    unsigned char *seen = index ? (unsigned char*)calloc(total_blocks + 1, 1) : NULL;
+    
+    for (int k = 0; k < plan->num_bits; k++) {
+        int bit = get_bit(watermark, k);
         
-        // Extract block
-        for (int i = 0; i < BLOCK_SIZE; i++) {
-            for (int j = 0; j < BLOCK_SIZE; j++) {
-                int y = block_y * BLOCK_SIZE + i;
-                int x = block_x * BLOCK_SIZE + j;
-                if (y < img->height && x < img->width) {
-                    block[i][j] = (double)img->data[y][x];
-                } else {
-                    block[i][j] = 0.0;
-                }
+        if (index) {
+            WatermarkIndexEntry *entry = &index->entries[index->num_entries++];
+            entry->block = plan->block[k];
+            entry->bit = bit;
+            if (!seen[entry->block]) {
+                seen[entry->block] = 1;
+                save_block(img, plan->row[k], plan->col[k], entry->pixels);
             }
         }
         
-        forward_dct(block, dct_block);
-        
-        int bit = (watermark[watermark_bit / 8] >> (7 - (watermark_bit % 8))) & 1;
+        embed_block_bit(plan, img, plan->row[k], plan->col[k], bit, alpha, auto_strength);
+    }
+    if (index) {
+        link_index(index, total_blocks);
+        free(seen);
+    }
+}
+
+void embed_watermark(MyImage *img, char *watermark, int watermark_length, double alpha) {
+    EmbedPlan *plan = get_embed_plan(img->width, img->height, WATERMARK_SEED, watermark_length);
+    embed_watermark_plan(img, plan, watermark, alpha);
+}
+
+// Plans address blocks by pixel position, so they only fit the size they were built for
+static int plan_fits_image(const EmbedPlan *plan, MyImage *img) {
+    if (img->width != plan->width || img->height != plan->height) {
+        printf("Error: Embedding plan is for a %dx%d image, got %dx%d\n",
+               plan->width, plan->height, img->width, img->height);
+        return 0;
+    }
+    return 1;
+}
+
+void embed_watermark_plan(MyImage *img, const EmbedPlan *plan, char *watermark, double alpha) {
+    if (!plan_fits_image(plan, img)) return;
+    embed_bits(img, plan, watermark, alpha, 0, NULL);
+}
+
+double alpha_from_quant_table(const unsigned short qtable[BLOCK_SIZE * BLOCK_SIZE]) {
+    // Re-quantization moves each coefficient by at most half its step, so a
+    // separation above (q34 + q43) / 2 keeps the order; the rounding margin
+    // covers pixel rounding when embedding and when decoding
+    double q34 = qtable[3 * BLOCK_SIZE + 4];
+    double q43 = qtable[4 * BLOCK_SIZE + 3];
+    double separation = (q34 + q43) / 2.0 + 4.0 * ROUNDING_MARGIN;
+    return separation / 2.0;
+}
+
+void embed_watermark_auto(MyImage *img, char *watermark, int watermark_length,
+                          const unsigned short qtable[BLOCK_SIZE * BLOCK_SIZE]) {
+    EmbedPlan *plan = get_embed_plan(img->width, img->height, WATERMARK_SEED, watermark_length);
+    embed_bits(img, plan, watermark, alpha_from_quant_table(qtable), 1, NULL);
+}
+
+static WatermarkIndex* create_index(MyImage *img, const EmbedPlan *plan, double alpha, int auto_strength) {
+    WatermarkIndex *index = (WatermarkIndex*)malloc(sizeof(WatermarkIndex));
+    index->width = img->width;
+    index->height = img->height;
+    index->seed = plan->seed;
+    index->watermark_length = plan->watermark_length;
+    index->alpha = alpha;
+    index->auto_strength = auto_strength;
+    index->num_entries = 0;
+    index->entries = (WatermarkIndexEntry*)malloc((plan->num_bits + 1) * sizeof(WatermarkIndexEntry));
+    return index;
+}
+
+WatermarkIndex* embed_watermark_indexed(MyImage *img, char *watermark, int watermark_length, double alpha) {
+    EmbedPlan *plan = get_embed_plan(img->width, img->height, WATERMARK_SEED, watermark_length);
+    WatermarkIndex *index = create_index(img, plan, alpha, 0);
+    
+    embed_bits(img, plan, watermark, alpha, 0, index);
+    return index;
+}
+
+WatermarkIndex* embed_watermark_indexed_auto(MyImage *img, char *watermark, int watermark_length,
+                                             const unsigned short qtable[BLOCK_SIZE * BLOCK_SIZE]) {
+    EmbedPlan *plan = get_embed_plan(img->width, img->height, WATERMARK_SEED, watermark_length);
+    double alpha = alpha_from_quant_table(qtable);
+    WatermarkIndex *index = create_index(img, plan, alpha, 1);
+    
+    embed_bits(img, plan, watermark, alpha, 1, index);
+    return index;
+}
+
+// The index must come from an embed with this plan: same block for every record
+static int index_matches_plan(WatermarkIndex *index, const EmbedPlan *plan) {
+    if (index->num_entries > plan->num_bits) return 0;
+    for (int k = 0; k < index->num_entries; k++) {
+        if (index->entries[k].block != plan->block[k]) return 0;
+    }
+    return 1;
+}
+
+// Rewrites every block in the index that carries a changed bit (or, for a
+// rollback, every block). generate_sequence draws with replacement, so a block
+// can carry several bits: the block is restored to the pixels saved before its
+// first changed record, and the rest of its chain is embedded again in order,
+// exactly as a fresh embed would.
+static int rewrite_blocks(MyImage *img, WatermarkIndex *index, char *new_watermark, int rollback) {
+    if (img->width != index->width || img->height != index->height) {
+        printf("Error: Watermark index is for a %dx%d image, got %dx%d\n",
+               index->width, index->height, img->width, img->height);
+        return -1;
+    }
+    
+    EmbedPlan *plan = get_embed_plan(index->width, index->height, index->seed, index->watermark_length);
+    if (!index_matches_plan(index, plan)) {
+        printf("Error: Watermark index does not match the embedding sequence\n");
+        return -1;
+    }
+    int total_blocks = (img->width / BLOCK_SIZE) * (img->height / BLOCK_SIZE);
+    unsigned char *done = (unsigned char*)calloc(total_blocks + 1, 1);
+    int touched = 0;
+    
+    for (int k = 0; k < index->num_entries; k++) {
+        WatermarkIndexEntry *entry = &index->entries[k];
+        if (done[entry->block]) continue;
+        done[entry->block] = 1;
         
-        if (bit == 1) {
-            if (dct_block[3][4] <= dct_block[4][3]) {
-                double avg = (dct_block[3][4] + dct_block[4][3]) / 2.0;
-                dct_block[3][4] = avg + alpha;
-                dct_block[4][3] = avg - alpha;
-            }
-        } else {
-            if (dct_block[4][3] <= dct_block[3][4]) {
-                double avg = (dct_block[3][4] + dct_block[4][3]) / 2.0;
-                dct_block[4][3] = avg + alpha;
-                dct_block[3][4] = avg - alpha;
-            }
+        // Records are visited in order, so entry is the block's first record
+        // and holds its original pixels. A re-mark rewrites the whole chain
+        // when any of its bits differ from the master's.
+        int changed = rollback;
+        for (int m = k; !changed && m >= 0; m = index->entries[m].next) {
+            changed = get_bit(new_watermark, m) != index->entries[m].bit;
         }
+        if (!changed) continue;
         
-        inverse_dct(dct_block, block);
-        
-        for (int i = 0; i < BLOCK_SIZE; i++) {
-            for (int j = 0; j < BLOCK_SIZE; j++) {
-                int y = block_y * BLOCK_SIZE + i;
-                int x = block_x * BLOCK_SIZE + j;
-                if (y < img->height && x < img->width) {
-                    int pixel_val = (int)round(block[i][j]);
-                    if (pixel_val < 0) pixel_val = 0;
-                    if (pixel_val > 255) pixel_val = 255;
-                    img->data[y][x] = (unsigned char)pixel_val;
-                }
+        restore_block(img, plan->row[k], plan->col[k], entry->pixels);
+        if (!rollback) {
+            for (int m = k; m >= 0; m = index->entries[m].next) {
+                embed_block_bit(plan, img, plan->row[m], plan->col[m], get_bit(new_watermark, m),
+                                index->alpha, index->auto_strength);
             }
         }
-        
-        watermark_bit++;
+        touched++;
     }
     
-    free(block_sequence);
+    free(done);
+    return touched;
+}
+
+int remark_watermark(MyImage *img, WatermarkIndex *index, char *new_watermark) {
+    return rewrite_blocks(img, index, new_watermark, 0);
+}
+
+int rollback_watermark(MyImage *img, WatermarkIndex *index) {
+    return rewrite_blocks(img, index, NULL, 1);
 }
 
 void extract_watermark(MyImage *img, char *extracted_watermark, int watermark_length) {
-    int blocks_x = img->width / BLOCK_SIZE;
-    int blocks_y = img->height / BLOCK_SIZE;
-    int total_blocks = blocks_x * blocks_y;
-    
-    int *block_sequence = (int*)malloc(total_blocks * sizeof(int));
-    generate_sequence(block_sequence, total_blocks, 12345);
-    
+    EmbedPlan *plan = get_embed_plan(img->width, img->height, WATERMARK_SEED, watermark_length);
+    extract_watermark_plan(img, plan, extracted_watermark);
+}
+
+// Reads a tied pair the way the original full-block DCT embedder did, so
+// blocks that a mark issued by it left tied still read as it would read them
+static int tied_pair_bit(MyImage *img, int row, int col) {
     double block[BLOCK_SIZE][BLOCK_SIZE];
     double dct_block[BLOCK_SIZE][BLOCK_SIZE];
-    
-    int watermark_bytes = (watermark_length + 7) / 8;
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        for (int j = 0; j < BLOCK_SIZE; j++) {
+            block[i][j] = (double)img->data[row + i][col + j];
+        }
+    }
+    forward_dct(block, dct_block);
+    return dct_block[3][4] > dct_block[4][3];
+}
+
+void extract_watermark_plan(MyImage *img, const EmbedPlan *plan, char *extracted_watermark) {
+    int watermark_bytes = (plan->watermark_length + 7) / 8;
     memset(extracted_watermark, 0, watermark_bytes);
+    if (!plan_fits_image(plan, img)) return;
     
-    int watermark_bit = 0;
-    
-    for (int block_idx = 0; block_idx < total_blocks && watermark_bit < watermark_length; block_idx++) {
-        int selected_block = block_sequence[block_idx];
-        int block_y = selected_block / blocks_x;
-        int block_x = selected_block % blocks_x;
-        
-        for (int i = 0; i < BLOCK_SIZE; i++) {
-            for (int j = 0; j < BLOCK_SIZE; j++) {
-                int y = block_y * BLOCK_SIZE + i;
-                int x = block_x * BLOCK_SIZE + j;
-                if (y < img->height && x < img->width) {
-                    block[i][j] = (double)img->data[y][x];
-                } else {
-                    block[i][j] = 0.0;
-                }
-            }
-        }
-        
-        forward_dct(block, dct_block);
-        
-        int bit = (dct_block[3][4] > dct_block[4][3]) ? 1 : 0;
+    for (int k = 0; k < plan->num_bits; k++) {
+        double c34, c43;
+        gather_pair(plan, img, plan->row[k], plan->col[k], &c34, &c43);
         
+        int bit = fabs(c34 - c43) < TIE_EPSILON ? tied_pair_bit(img, plan->row[k], plan->col[k])
+                                                : c34 > c43;
         if (bit) {
-            extracted_watermark[watermark_bit / 8] |= (1 << (7 - (watermark_bit % 8)));
+            extracted_watermark[k / 8] |= (1 << (7 - (k % 8)));
+        }
+    }
+}
+
+int save_watermark_index(WatermarkIndex *index, const char *filename) {
+    FILE *outfile;
+    int32_t header[7];
+    
+    if ((outfile = fopen(filename, "wb")) == NULL) {
+        printf("Error: Cannot create watermark index %s\n", filename);
+        return 0;
+    }
+    
+    header[0] = WATERMARK_INDEX_MAGIC;
+    header[1] = index->width;
+    header[2] = index->height;
+    header[3] = index->seed;
+    header[4] = index->watermark_length;
+    header[5] = index->num_entries;
+    header[6] = index->auto_strength;
+    fwrite(header, sizeof(int32_t), 7, outfile);
+    fwrite(&index->alpha, sizeof(double), 1, outfile);
+    
+    // Original pixels are stored once per block, after its first record
+    int total_blocks = (index->width / BLOCK_SIZE) * (index->height / BLOCK_SIZE);
+    unsigned char *seen = (unsigned char*)calloc(total_blocks + 1, 1);
+    for (int k = 0; k < index->num_entries; k++) {
+        int32_t record[2] = { index->entries[k].block, index->entries[k].bit };
+        fwrite(record, sizeof(int32_t), 2, outfile);
+        if (!seen[record[0]]) {
+            seen[record[0]] = 1;
+            fwrite(index->entries[k].pixels, 1, BLOCK_SIZE * BLOCK_SIZE, outfile);
         }
-        
-        watermark_bit++;
     }
+    free(seen);
     
-    free(block_sequence);
+    fclose(outfile);
+    printf("Saved watermark index as %s (%d blocks)\n", filename, index->num_entries);
+    return 1;
+}
+
+WatermarkIndex* load_watermark_index(const char *filename) {
+    FILE *infile;
+    int32_t header[7];
+    
+    if ((infile = fopen(filename, "rb")) == NULL) {
+        printf("Error: Cannot open watermark index %s\n", filename);
+        return NULL;
+    }
+    
+    if (fread(header, sizeof(int32_t), 7, infile) != 7 || header[0] != WATERMARK_INDEX_MAGIC) {
+        printf("Error: %s is not a watermark index\n", filename);
+        fclose(infile);
+        return NULL;
+    }
+    
+    // Every record must fit the image the header describes
+    int64_t total_blocks = (int64_t)(header[1] / BLOCK_SIZE) * (header[2] / BLOCK_SIZE);
+    int64_t max_entries = header[4] < total_blocks ? header[4] : total_blocks;
+    if (header[1] <= 0 || header[2] <= 0 || total_blocks > INT32_MAX || header[4] < 0 ||
+        header[5] < 0 || header[5] > max_entries || (header[6] != 0 && header[6] != 1)) {
+        printf("Error: Watermark index %s has an invalid header\n", filename);
+        fclose(infile);
+        return NULL;
+    }
+    
+    WatermarkIndex *index = (WatermarkIndex*)malloc(sizeof(WatermarkIndex));
+    index->width = header[1];
+    index->height = header[2];
+    index->seed = header[3];
+    index->watermark_length = header[4];
+    index->num_entries = header[5];
+    index->auto_strength = header[6];
+    index->entries = (WatermarkIndexEntry*)malloc((index->num_entries + 1) * sizeof(WatermarkIndexEntry));
+    
+    unsigned char *seen = (unsigned char*)calloc(total_blocks + 1, 1);
+    int ok = fread(&index->alpha, sizeof(double), 1, infile) == 1;
+    int valid = 1;
+    for (int k = 0; ok && valid && k < index->num_entries; k++) {
+        int32_t record[2] = { 0, 0 };
+        ok = fread(record, sizeof(int32_t), 2, infile) == 2;
+        index->entries[k].block = record[0];
+        index->entries[k].bit = record[1];
+        if (record[0] < 0 || record[0] >= total_blocks || (record[1] != 0 && record[1] != 1)) {
+            valid = 0;
+        } else if (ok && !seen[record[0]]) {
+            seen[record[0]] = 1;
+            ok = fread(index->entries[k].pixels, 1, BLOCK_SIZE * BLOCK_SIZE, infile) == BLOCK_SIZE * BLOCK_SIZE;
+        }
+    }
+    free(seen);
+    fclose(infile);
+    
+    if (!ok || !valid) {
+        printf("Error: Watermark index %s is %s\n", filename, ok ? "corrupt" : "truncated");
+        free_watermark_index(index);
+        return NULL;
+    }
+    link_index(index, (int)total_blocks);
+    return index;
+}
+
+void free_watermark_index(WatermarkIndex *index) {
+    free(index->entries);
+    free(index);
 }
 
 double calculate_similarity(char *watermark1, char *watermark2, int length) {
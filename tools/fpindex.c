@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fingerprint.h"
+
+// Builds, appends to and queries a fingerprint index of issued payloads.
+// Payloads are given as text (like the watermark string) or as "hex:..." for
+// raw extracted bits.
+
+static void usage(const char *prog) {
+    printf("Usage: %s create <index> <payload_bits>\n", prog);
+    printf("       %s add <index> <recipient_id> <payload>\n", prog);
+    printf("       %s import <index> <list_file>   (one \"<recipient_id> <payload>\" per line)\n", prog);
+    printf("       %s build <index>                (rebuild the hash tables)\n", prog);
+    printf("       %s query <index> <payload> [k] [max_distance]   (default k = 1, max_distance = bits / 4)\n", prog);
+    printf("Payloads are text, or hex digits prefixed with \"hex:\".\n");
+    printf("import rebuilds the hash tables; payloads added later are scanned until the next build.\n");
+}
+
+// Parse a payload argument into payload_bytes bytes (zero padded). Returns 1 on success.
+static int parse_payload(const char *arg, char *payload, int payload_bytes) {
+    memset(payload, 0, payload_bytes);
+    if (strncmp(arg, "hex:", 4) == 0) {
+        const char *hex = arg + 4;
+        int digits = strlen(hex);
+        if (digits % 2 || digits / 2 > payload_bytes) return 0;
+        for (int i = 0; i < digits / 2; i++) {
+            unsigned int byte;
+            if (sscanf(hex + 2 * i, "%2x", &byte) != 1) return 0;
+            payload[i] = (char)byte;
+        }
+        return 1;
+    }
+    if ((int)strlen(arg) > payload_bytes) return 0;
+    memcpy(payload, arg, strlen(arg));
+    return 1;
+}
+
+static int index_payload_bytes(const char *filename) {
+    FingerprintIndex *index = fingerprint_index_open(filename);
+    if (!index) return 0;
+    int payload_bytes = (index->payload_bits + 7) / 8;
+    fingerprint_index_close(index);
+    return payload_bytes;
+}
+
+static int cmd_add(const char *filename, const char *id_arg, const char *payload_arg) {
+    int payload_bytes = index_payload_bytes(filename);
+    if (!payload_bytes) return 1;
+
+    char *payload = (char*)malloc(payload_bytes);
+    uint64_t recipient_id = strtoull(id_arg, NULL, 10);
+    int ok = parse_payload(payload_arg, payload, payload_bytes);
+    if (!ok) {
+        printf("Error: Payload does not fit in %d bytes\n", payload_bytes);
+    } else {
+        ok = fingerprint_index_append(filename, &recipient_id, payload, 1);
+    }
+    free(payload);
+    return ok ? 0 : 1;
+}
+
+static int cmd_import(const char *filename, const char *list_filename) {
+    int payload_bytes = index_payload_bytes(filename);
+    if (!payload_bytes) return 1;
+
+    FILE *list;
+    if ((list = fopen(list_filename, "r")) == NULL) {
+        printf("Error: Cannot open %s\n", list_filename);
+        return 1;
+    }
+
+    // Append in batches so the header is rewritten once per batch
+    const int batch = 4096;
+    uint64_t *ids = (uint64_t*)malloc(batch * sizeof(uint64_t));
+    char *payloads = (char*)malloc((size_t)batch * payload_bytes);
+    char line[1024];
+    long imported = 0, line_number = 0;
+    int pending = 0, ok = 1;
+
+    while (ok && fgets(line, sizeof(line), list)) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *space = strchr(line, ' ');
+        if (line[0] == '\0') continue;
+        if (!space || !parse_payload(space + 1, payloads + (size_t)pending * payload_bytes, payload_bytes)) {
+            printf("Warning: Skipping malformed line %ld\n", line_number);
+            continue;
+        }
+        ids[pending++] = strtoull(line, NULL, 10);
+        if (pending == batch) {
+            ok = fingerprint_index_append(filename, ids, payloads, pending);
+            if (ok) imported += pending;
+            pending = 0;
+        }
+    }
+    if (ok && pending) {
+        ok = fingerprint_index_append(filename, ids, payloads, pending);
+        if (ok) imported += pending;
+    }
+
+    fclose(list);
+    free(ids);
+    free(payloads);
+    printf("Imported %ld payloads into %s\n", imported, filename);
+    if (ok) ok = fingerprint_index_build_mih(filename);
+    return ok ? 0 : 1;
+}
+
+static int cmd_query(const char *filename, const char *payload_arg, int k, int max_distance) {
+    FingerprintIndex *index = fingerprint_index_open(filename);
+    if (!index) return 1;
+
+    int payload_bytes = (index->payload_bits + 7) / 8;
+    char *payload = (char*)malloc(payload_bytes);
+    if (!parse_payload(payload_arg, payload, payload_bytes)) {
+        printf("Error: Payload does not fit in %d bytes\n", payload_bytes);
+        free(payload);
+        fingerprint_index_close(index);
+        return 1;
+    }
+    if (max_distance < 0) max_distance = index->payload_bits / 4;
+
+    FingerprintMatch matches[FINGERPRINT_MAX_K];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int found = fingerprint_index_search(index, payload, max_distance, matches, k);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    uint64_t hashed = index->mih ? index->mih->count : 0;
+    printf("Searched %llu payloads (%llu hashed) in %.3f ms\n", (unsigned long long)index->count,
+           (unsigned long long)hashed, elapsed_ms);
+    for (int m = 0; m < found; m++) {
+        printf("%2d. recipient %llu: %d bit errors (%.2f%% similarity)\n", m + 1,
+               (unsigned long long)matches[m].recipient_id, matches[m].distance,
+               100.0 * (index->payload_bits - matches[m].distance) / index->payload_bits);
+    }
+    if (found == 0) {
+        printf("No payload within %d bit errors\n", max_distance);
+    }
+
+    free(payload);
+    fingerprint_index_close(index);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 4 && strcmp(argv[1], "create") == 0) {
+        return fingerprint_index_create(argv[2], atoi(argv[3])) ? 0 : 1;
+    }
+    if (argc == 5 && strcmp(argv[1], "add") == 0) {
+        return cmd_add(argv[2], argv[3], argv[4]);
+    }
+    if (argc == 4 && strcmp(argv[1], "import") == 0) {
+        return cmd_import(argv[2], argv[3]);
+    }
+    if (argc == 3 && strcmp(argv[1], "build") == 0) {
+        return fingerprint_index_build_mih(argv[2]) ? 0 : 1;
+    }
+    if (argc >= 4 && strcmp(argv[1], "query") == 0) {
+        int k = argc > 4 ? atoi(argv[4]) : 1;
+        int max_distance = argc > 5 ? atoi(argv[5]) : -1;
+        return cmd_query(argv[2], argv[3], k, max_distance);
+    }
+
+    usage(argv[0]);
+    return 1;
+}